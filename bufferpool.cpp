@@ -0,0 +1,202 @@
+
+//
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) Contributors to the OpenEXR Project.
+//
+
+#include "bufferpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <stdexcept>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std::chrono;
+using std::runtime_error;
+
+namespace
+{
+
+const size_t alignment    = 64;
+const size_t hugePageSize = 2 * 1024 * 1024;
+
+size_t
+roundUp (size_t size, size_t multiple)
+{
+    return (size + multiple - 1) / multiple * multiple;
+}
+
+double
+timing (steady_clock::time_point start, steady_clock::time_point end)
+{
+    return std::chrono::duration<double> (end - start).count ();
+}
+
+} // namespace
+
+BufferPool::BufferPool (bool reuse, HugePages hugePages)
+    : _reuse (reuse), _hugePages (hugePages), _allocTime (0), _firstTouchTime (0)
+{}
+
+BufferPool::~BufferPool ()
+{
+    for (const Block& block: _blocks)
+    {
+        freeBlock (block);
+    }
+}
+
+char*
+BufferPool::allocate (size_t size)
+{
+    size = roundUp (std::max (size, alignment), alignment);
+
+    steady_clock::time_point startAlloc = steady_clock::now ();
+
+    //
+    // smallest free block that fits
+    //
+    Block* best = nullptr;
+    for (Block& block: _blocks)
+    {
+        if (!block.inUse && block.size >= size &&
+            (!best || block.size < best->size))
+        {
+            best = &block;
+        }
+    }
+
+    if (best)
+    {
+        best->inUse = true;
+        _allocTime += timing (startAlloc, steady_clock::now ());
+        return best->data;
+    }
+
+    Block block = newBlock (size);
+    _blocks.push_back (block);
+
+    steady_clock::time_point endAlloc = steady_clock::now ();
+    _allocTime += timing (startAlloc, endAlloc);
+
+    if (_reuse)
+    {
+        //
+        // fault every page in now, on this thread, so decode never does
+        //
+        size_t pageSize = sysconf (_SC_PAGESIZE);
+        for (size_t offset = 0; offset < block.size; offset += pageSize)
+        {
+            block.data[offset] = 0;
+        }
+        _firstTouchTime += timing (endAlloc, steady_clock::now ());
+    }
+
+    return block.data;
+}
+
+void
+BufferPool::release ()
+{
+    if (_reuse)
+    {
+        for (Block& block: _blocks)
+        {
+            block.inUse = false;
+        }
+        return;
+    }
+
+    for (const Block& block: _blocks)
+    {
+        freeBlock (block);
+    }
+    _blocks.clear ();
+}
+
+void
+BufferPool::resetTimes ()
+{
+    _allocTime      = 0;
+    _firstTouchTime = 0;
+}
+
+uint64_t
+BufferPool::size () const
+{
+    uint64_t total = 0;
+    for (const Block& block: _blocks)
+    {
+        total += block.size;
+    }
+    return total;
+}
+
+BufferPool::Block
+BufferPool::newBlock (size_t size)
+{
+    void* data = nullptr;
+
+    //
+    // a request smaller than a huge page would commit a whole one once
+    // touched: small planes, such as high mip levels or preview planes,
+    // take normal pages
+    //
+    HugePages pages = size < hugePageSize ? NO_HUGE_PAGES : _hugePages;
+
+    switch (pages)
+    {
+        case EXPLICIT_HUGE_PAGES:
+            size = roundUp (size, hugePageSize);
+            data = mmap (
+                nullptr,
+                size,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                -1,
+                0);
+            if (data == MAP_FAILED)
+            {
+                throw runtime_error (
+                    "cannot allocate explicit huge pages: check "
+                    "/proc/sys/vm/nr_hugepages");
+            }
+            break;
+
+        case TRANSPARENT_HUGE_PAGES:
+            size = roundUp (size, hugePageSize);
+            if (posix_memalign (&data, hugePageSize, size) != 0)
+            {
+                throw std::bad_alloc ();
+            }
+            madvise (data, size, MADV_HUGEPAGE);
+            break;
+
+        case NO_HUGE_PAGES:
+        default:
+            if (posix_memalign (&data, alignment, size) != 0)
+            {
+                throw std::bad_alloc ();
+            }
+            break;
+    }
+
+    //
+    // what vector<char>::resize would have done
+    //
+    if (!_reuse) { memset (data, 0, size); }
+
+    return {static_cast<char*> (data), size, true, pages};
+}
+
+void
+BufferPool::freeBlock (const Block& block)
+{
+    if (block.pages == EXPLICIT_HUGE_PAGES) { munmap (block.data, block.size); }
+    else { free (block.data); }
+}
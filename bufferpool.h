@@ -0,0 +1,90 @@
+
+#ifndef INCLUDED_BUFFER_POOL_H
+#define INCLUDED_BUFFER_POOL_H
+
+//----------------------------------------------------------------------------
+//
+//	Frame buffer memory that can be kept and reused across frames
+//
+//----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/// Page size backing pooled buffers.
+enum HugePages
+{
+    NO_HUGE_PAGES,
+    TRANSPARENT_HUGE_PAGES, // 2MB aligned, madvise (MADV_HUGEPAGE)
+    EXPLICIT_HUGE_PAGES     // mmap (MAP_HUGETLB), needs vm.nr_hugepages
+};
+
+///
+/// Hands out 64 byte aligned buffers for pixel data.
+///
+/// Without reuse every buffer is freshly allocated and zero filled, as a
+/// vector<char> would be, and freed by release(). With reuse, buffers are
+/// left uninitialized, their pages are touched once when first allocated,
+/// and release() only marks them free for the next frame to pick up.
+///
+/// Huge pages only back buffers of at least one huge page; smaller ones
+/// take normal pages rather than each committing a whole huge page.
+///
+/// Not thread safe: use one pool per thread that allocates.
+///
+class BufferPool
+{
+public:
+    explicit BufferPool (bool reuse = false, HugePages hugePages = NO_HUGE_PAGES);
+    ~BufferPool ();
+
+    BufferPool (const BufferPool&)            = delete;
+    BufferPool& operator= (const BufferPool&) = delete;
+
+    /// At least size bytes, valid until the next release ().
+    char* allocate (size_t size);
+
+    template <class T> T* allocate (size_t count)
+    {
+        return reinterpret_cast<T*> (allocate (count * sizeof (T)));
+    }
+
+    /// Return every buffer to the pool, or free them without reuse.
+    void release ();
+
+    bool      reuse () const { return _reuse; }
+    HugePages hugePages () const { return _hugePages; }
+
+    /// Seconds spent obtaining memory since the last resetTimes ().
+    double allocTime () const { return _allocTime; }
+
+    /// Seconds spent faulting in new pooled pages since the last
+    /// resetTimes (). Without reuse, zero filling counts as allocation.
+    double firstTouchTime () const { return _firstTouchTime; }
+
+    void resetTimes ();
+
+    /// Bytes currently held, in use or free.
+    uint64_t size () const;
+
+private:
+    struct Block
+    {
+        char*     data;
+        size_t    size;
+        bool      inUse;
+        HugePages pages; // what backs this block
+    };
+
+    Block newBlock (size_t size);
+    void  freeBlock (const Block& block);
+
+    bool               _reuse;
+    HugePages          _hugePages;
+    std::vector<Block> _blocks;
+    double             _allocTime;
+    double             _firstTouchTime;
+};
+
+#endif
@@ -0,0 +1,240 @@
+
+//
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) Contributors to the OpenEXR Project.
+//
+
+#include "deepflatten.h"
+#include "parallel.h"
+
+#include "half.h"
+
+#include <algorithm>
+#include <string.h>
+
+using namespace Imf;
+using std::string;
+using std::vector;
+
+namespace
+{
+
+inline float
+load (const uint16_t* samples, int i)
+{
+    half h;
+    h.setBits (samples[i]);
+    return h;
+}
+
+inline float
+load (const float* samples, int i)
+{
+    return samples[i];
+}
+
+inline float
+load (const uint32_t* samples, int i)
+{
+    return static_cast<float> (samples[i]);
+}
+
+//
+// The type is switched on once per channel and pixel; the loops over the
+// samples are compiled for each type.
+//
+template <class Function>
+auto
+dispatch (PixelType type, const char* samples, Function fn)
+{
+    switch (type)
+    {
+        case HALF: return fn (reinterpret_cast<const uint16_t*> (samples));
+        case FLOAT: return fn (reinterpret_cast<const float*> (samples));
+        default: return fn (reinterpret_cast<const uint32_t*> (samples));
+    }
+}
+
+float
+sampleValue (PixelType type, const char* samples, int i)
+{
+    return dispatch (type, samples, [&] (auto s) { return load (s, i); });
+}
+
+//
+// the first n samples as float
+//
+void
+unpack (PixelType type, const char* samples, int n, float* out)
+{
+    dispatch (type, samples, [&] (auto s) {
+        for (int i = 0; i < n; ++i)
+        {
+            out[i] = load (s, i);
+        }
+    });
+}
+
+//
+// sum of weight[k] times sample order[k], for k in [0, n)
+//
+float
+weightedSum (
+    PixelType    type,
+    const char*  samples,
+    const int*   order,
+    const float* weight,
+    int          n)
+{
+    return dispatch (type, samples, [&] (auto s) {
+        float sum = 0;
+        for (int k = 0; k < n; ++k)
+        {
+            sum += weight[k] * load (s, order[k]);
+        }
+        return sum;
+    });
+}
+
+//
+// What the kernel does with each channel
+//
+enum Role
+{
+    COMPOSITE, // summed over, attenuated by the samples in front
+    ALPHA,     // 1 - the light let through by all samples
+    NEAREST    // the nearest sample's value: Z, ZBack and UINT ids
+};
+
+const uint64_t blockSize = 4096; // pixels per parallelFor index
+
+} // namespace
+
+void
+flattenDeep (
+    const int*                 sampleCount,
+    uint64_t                   numPixels,
+    const vector<DeepChannel>& channels,
+    const vector<char*>&       out,
+    int                        numThreads)
+{
+    int          numChans = static_cast<int> (channels.size ());
+    vector<Role> roles (numChans, COMPOSITE);
+    int          alpha = -1;
+    int          depth = -1;
+    for (int c = 0; c < numChans; ++c)
+    {
+        const string& name = channels[c].name;
+        if (name == "A")
+        {
+            roles[c] = ALPHA;
+            alpha    = c;
+        }
+        else if (name == "Z")
+        {
+            roles[c] = NEAREST;
+            depth    = c;
+        }
+        else if (name == "ZBack" || channels[c].type == UINT)
+        {
+            roles[c] = NEAREST;
+        }
+    }
+
+    numThreads = std::max (1, numThreads);
+    int blocks = static_cast<int> ((numPixels + blockSize - 1) / blockSize);
+
+    //
+    // sample order, weights and unpacked Z or A per thread, reused for
+    // every pixel
+    //
+    vector<vector<int>>   orders (numThreads);
+    vector<vector<float>> weights (numThreads);
+    vector<vector<float>> values (numThreads);
+
+    parallelFor (blocks, numThreads, [&] (int thread, int b) {
+        vector<int>&   order  = orders[thread];
+        vector<float>& weight = weights[thread];
+        vector<float>& value  = values[thread];
+        uint64_t       first  = b * blockSize;
+        uint64_t       last   = std::min (first + blockSize, numPixels);
+
+        for (uint64_t p = first; p < last; ++p)
+        {
+            int n = sampleCount[p];
+            order.resize (n);
+            weight.resize (n);
+            value.resize (n);
+            for (int i = 0; i < n; ++i)
+            {
+                order[i] = i;
+            }
+            if (depth >= 0 && n > 1)
+            {
+                unpack (
+                    channels[depth].type,
+                    channels[depth].pixelPtrs[p],
+                    n,
+                    value.data ());
+                std::stable_sort (
+                    order.begin (), order.end (), [&] (int a, int b) {
+                        return value[a] < value[b];
+                    });
+            }
+
+            //
+            // front to back: each sample is seen through those before it,
+            // stopping once nothing more shows through. Without A every
+            // sample is opaque.
+            //
+            if (alpha >= 0)
+            {
+                unpack (
+                    channels[alpha].type,
+                    channels[alpha].pixelPtrs[p],
+                    n,
+                    value.data ());
+            }
+            float transmit = 1;
+            int   used     = 0;
+            while (used < n && transmit > 0)
+            {
+                float a        = alpha >= 0 ? value[order[used]] : 1;
+                weight[used++] = transmit;
+                transmit *= 1 - a;
+            }
+
+            for (int c = 0; c < numChans; ++c)
+            {
+                if (roles[c] == NEAREST && channels[c].type == UINT)
+                {
+                    reinterpret_cast<uint32_t*> (out[c])[p] =
+                        n ? reinterpret_cast<const uint32_t*> (
+                                channels[c].pixelPtrs[p])[order[0]]
+                          : 0;
+                    continue;
+                }
+
+                float result = 1 - transmit;
+                if (roles[c] == COMPOSITE)
+                {
+                    result = weightedSum (
+                        channels[c].type,
+                        channels[c].pixelPtrs[p],
+                        order.data (),
+                        weight.data (),
+                        used);
+                }
+                else if (roles[c] == NEAREST)
+                {
+                    result = n ? sampleValue (
+                                     channels[c].type,
+                                     channels[c].pixelPtrs[p],
+                                     order[0])
+                               : 0;
+                }
+                reinterpret_cast<float*> (out[c])[p] = result;
+            }
+        }
+    });
+}
@@ -0,0 +1,41 @@
+
+#ifndef INCLUDED_DEEP_FLATTEN_H
+#define INCLUDED_DEEP_FLATTEN_H
+
+//----------------------------------------------------------------------------
+//
+//	Flatten decoded deep samples into a flat image: sort each pixel's
+//	samples by Z and composite them front to back
+//
+//----------------------------------------------------------------------------
+
+#include "ImfPixelType.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// One channel of decoded deep samples, as the deep copies lay them out.
+struct DeepChannel
+{
+    std::string    name;
+    Imf::PixelType type;
+    char* const*   pixelPtrs; // first sample of each pixel
+};
+
+///
+/// Flatten numPixels pixels of samples into out, one plane per channel:
+/// float for HALF and FLOAT channels, uint32_t for UINT ones. Samples are
+/// taken as premultiplied and composited over one another nearest Z
+/// first, in stored order without a Z channel. A becomes the combined
+/// alpha; Z, ZBack and UINT channels take the nearest sample's value.
+/// Pixels are spread over numThreads workers of the global pool.
+///
+void flattenDeep (
+    const int*                      sampleCount,
+    uint64_t                        numPixels,
+    const std::vector<DeepChannel>& channels,
+    const std::vector<char*>&       out,
+    int                             numThreads);
+
+#endif
@@ -0,0 +1,651 @@
+
+//
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) Contributors to the OpenEXR Project.
+//
+
+#include "exrcore.h"
+#include "bufferpool.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include "ImfChannelList.h"
+
+#include "openexr.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace Imf;
+
+using namespace std::chrono;
+using std::map;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace
+{
+
+void
+check (exr_result_t rv, const char* what)
+{
+    if (rv != EXR_ERR_SUCCESS)
+    {
+        throw runtime_error (
+            string (what) + " failed: " + exr_get_default_error_message (rv));
+    }
+}
+
+double
+timing (steady_clock::time_point start, steady_clock::time_point end)
+{
+    return std::chrono::duration<double> (end - start).count ();
+}
+
+//
+// close a context on scope exit
+//
+struct CoreContext
+{
+    exr_context_t ctxt = nullptr;
+    ~CoreContext ()
+    {
+        if (ctxt) { exr_finish (&ctxt); }
+    }
+};
+
+//
+// one pipeline per thread, initialized on first use
+//
+struct Decoders
+{
+    exr_const_context_t           ctxt;
+    vector<exr_decode_pipeline_t> pipes;
+    vector<char>                  started;
+
+    Decoders (exr_const_context_t c, int n) : ctxt (c), pipes (n), started (n)
+    {
+        for (exr_decode_pipeline_t& p: pipes)
+        {
+            p = EXR_DECODE_PIPELINE_INITIALIZER;
+        }
+    }
+    ~Decoders ()
+    {
+        for (size_t t = 0; t < pipes.size (); ++t)
+        {
+            if (started[t]) { exr_decoding_destroy (ctxt, &pipes[t]); }
+        }
+    }
+};
+
+struct Encoders
+{
+    exr_const_context_t           ctxt;
+    vector<exr_encode_pipeline_t> pipes;
+    vector<char>                  started;
+
+    Encoders (exr_const_context_t c, int n) : ctxt (c), pipes (n), started (n)
+    {
+        for (exr_encode_pipeline_t& p: pipes)
+        {
+            p = EXR_ENCODE_PIPELINE_INITIALIZER;
+        }
+    }
+    ~Encoders ()
+    {
+        for (size_t t = 0; t < pipes.size (); ++t)
+        {
+            if (started[t]) { exr_encoding_destroy (ctxt, &pipes[t]); }
+        }
+    }
+};
+
+//
+// pixels of one level, one pool buffer per channel, in the same layout the
+// Imf copy functions use
+//
+struct Level
+{
+    int           levelX;
+    int           levelY;
+    int64_t       width;
+    int64_t       height;
+    vector<char*> pixelData;
+};
+
+struct Chunk
+{
+    int level;
+    int tileX; // tile coordinates, or 0 and first scan line for scanline parts
+    int tileY;
+    int x0;    // offset of the chunk from the level origin, in pixels
+    int y0;
+};
+
+//
+// Point the channels of a pipeline at the chunk's place in its level.
+//
+void
+bindChannels (
+    exr_coding_channel_info_t* channels,
+    int                        channelCount,
+    const map<string, int>&    channelIndex,
+    const vector<int>&         channelTypes,
+    Level&                     level,
+    const Chunk&               chunk)
+{
+    for (int c = 0; c < channelCount; ++c)
+    {
+        exr_coding_channel_info_t& info = channels[c];
+        int  index = channelIndex.at (info.channel_name);
+        int  type  = channelTypes[index];
+        int  size  = type == EXR_PIXEL_HALF ? 2 : 4;
+        char* base = level.pixelData[index] +
+                     (chunk.y0 * level.width + chunk.x0) * size;
+
+        info.user_data_type         = type;
+        info.user_bytes_per_element = size;
+        info.user_pixel_stride      = size;
+        info.user_line_stride       = size * level.width;
+        info.decode_to_ptr          = reinterpret_cast<uint8_t*> (base);
+    }
+}
+
+//
+// Positions in chunks, which run level by level with rows of tiles or
+// scan lines increasing, in the order the part's line order puts them in
+// the file: for decreasing y the rows of each level are reversed, tiles
+// in a row still left to right. Random y keeps the chunks as they are.
+//
+vector<int>
+fileOrder (const vector<Chunk>& chunks, exr_lineorder_t lineOrder)
+{
+    vector<int> sequence (chunks.size ());
+    std::iota (sequence.begin (), sequence.end (), 0);
+    if (lineOrder != EXR_LINEORDER_DECREASING_Y) { return sequence; }
+
+    size_t next = 0;
+    for (size_t begin = 0, end; begin < chunks.size (); begin = end)
+    {
+        for (end = begin;
+             end < chunks.size () && chunks[end].level == chunks[begin].level;
+             ++end)
+        {}
+
+        for (size_t rowEnd = end, rowBegin; rowEnd > begin; rowEnd = rowBegin)
+        {
+            for (rowBegin = rowEnd - 1;
+                 rowBegin > begin &&
+                 chunks[rowBegin - 1].tileY == chunks[rowEnd - 1].tileY;
+                 --rowBegin)
+            {}
+
+            for (size_t i = rowBegin; i < rowEnd; ++i)
+            {
+                sequence[next++] = static_cast<int> (i);
+            }
+        }
+    }
+    return sequence;
+}
+
+//
+// Encoding threads hand compressed chunks to the file in file order
+//
+struct OrderedWriter
+{
+    exr_context_t           ctxt;
+    int                     part;
+    bool                    tiled;
+    std::mutex              mutex;
+    std::condition_variable turn;
+    int                     next   = 0;
+    bool                    failed = false;
+};
+
+struct EncodeJob
+{
+    OrderedWriter* writer;
+    int            sequence;
+    const Chunk*   chunk;
+};
+
+exr_result_t
+writeInOrder (exr_encode_pipeline_t* encode)
+{
+    EncodeJob*     job    = static_cast<EncodeJob*> (encode->encoding_user_data);
+    OrderedWriter& writer = *job->writer;
+
+    std::unique_lock<std::mutex> lock (writer.mutex);
+    {
+        TraceSpan span ("wait to write", "chunk", "sequence", job->sequence);
+        writer.turn.wait (lock, [&] {
+            return writer.failed || writer.next == job->sequence;
+        });
+    }
+    if (writer.failed) { return EXR_ERR_UNKNOWN; }
+    TraceSpan span ("write chunk", "chunk", "sequence", job->sequence);
+
+    const void* data  = encode->compressed_buffer;
+    uint64_t    bytes = encode->compressed_bytes;
+    if (!data)
+    {
+        data  = encode->packed_buffer;
+        bytes = encode->packed_bytes;
+    }
+
+    exr_result_t rv;
+    if (writer.tiled)
+    {
+        rv = exr_write_tile_chunk (
+            writer.ctxt,
+            writer.part,
+            job->chunk->tileX,
+            job->chunk->tileY,
+            encode->chunk.level_x,
+            encode->chunk.level_y,
+            data,
+            bytes);
+    }
+    else
+    {
+        rv = exr_write_scanline_chunk (
+            writer.ctxt, writer.part, encode->chunk.start_y, data, bytes);
+    }
+
+    ++writer.next;
+    writer.turn.notify_all ();
+    return rv;
+}
+
+} // namespace
+
+CoreMetrics
+copyCore (
+    const char    inFileName[],
+    int           part,
+    const char    outFileName[],
+    const Header& outHeader,
+    BufferPool&   pool,
+    int           numThreads)
+{
+    numThreads = std::max (numThreads, 1);
+
+    CoreContext               in;
+    exr_context_initializer_t init = EXR_DEFAULT_CONTEXT_INITIALIZER;
+    check (exr_start_read (&in.ctxt, inFileName, &init), "exr_start_read");
+
+    exr_storage_t storage;
+    check (exr_get_storage (in.ctxt, part, &storage), "exr_get_storage");
+    if (storage != EXR_STORAGE_SCANLINE && storage != EXR_STORAGE_TILED)
+    {
+        throw runtime_error ("core engine only supports scanline and tiled parts");
+    }
+    bool tiled = storage == EXR_STORAGE_TILED;
+
+    exr_attr_box2i_t dw;
+    check (exr_get_data_window (in.ctxt, part, &dw), "exr_get_data_window");
+
+    map<string, int> channelIndex;
+    vector<int>      channelTypes;
+    for (ChannelList::ConstIterator i = outHeader.channels ().begin ();
+         i != outHeader.channels ().end ();
+         ++i)
+    {
+        channelIndex[i.name ()] = static_cast<int> (channelTypes.size ());
+        channelTypes.push_back (i.channel ().type);
+    }
+
+    //
+    // enumerate levels and the input's chunks, levels and rows increasing
+    //
+    vector<Level> levels;
+    vector<Chunk> chunks;
+
+    if (tiled)
+    {
+        uint32_t              tileW, tileH;
+        exr_tile_level_mode_t levelMode;
+        exr_tile_round_mode_t roundMode;
+        int32_t               numXLevels, numYLevels;
+        check (
+            exr_get_tile_descriptor (
+                in.ctxt, part, &tileW, &tileH, &levelMode, &roundMode),
+            "exr_get_tile_descriptor");
+        check (
+            exr_get_tile_levels (in.ctxt, part, &numXLevels, &numYLevels),
+            "exr_get_tile_levels");
+
+        for (int ly = 0; ly < numYLevels; ++ly)
+        {
+            for (int lx = 0; lx < numXLevels; ++lx)
+            {
+                if (levelMode != EXR_TILE_RIPMAP_LEVELS && lx != ly) continue;
+
+                int32_t w, h;
+                check (
+                    exr_get_level_sizes (in.ctxt, part, lx, ly, &w, &h),
+                    "exr_get_level_sizes");
+                levels.push_back ({lx, ly, w, h, {}});
+
+                int level = static_cast<int> (levels.size ()) - 1;
+                for (int ty = 0; ty * tileH < static_cast<uint32_t> (h); ++ty)
+                {
+                    for (int tx = 0; tx * tileW < static_cast<uint32_t> (w);
+                         ++tx)
+                    {
+                        chunks.push_back (
+                            {level,
+                             tx,
+                             ty,
+                             static_cast<int> (tx * tileW),
+                             static_cast<int> (ty * tileH)});
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        int32_t linesPerChunk;
+        check (
+            exr_get_scanlines_per_chunk (in.ctxt, part, &linesPerChunk),
+            "exr_get_scanlines_per_chunk");
+
+        int64_t height = static_cast<int64_t> (dw.max.y) - dw.min.y + 1;
+        levels.push_back ({0, 0, dw.max.x - dw.min.x + 1, height, {}});
+        for (int64_t y = 0; y < height; y += linesPerChunk)
+        {
+            chunks.push_back (
+                {0, 0, static_cast<int> (dw.min.y + y), 0, static_cast<int> (y)});
+        }
+    }
+
+    uint64_t totalPixels = 0;
+    for (Level& level: levels)
+    {
+        uint64_t numPixels = level.width * level.height;
+        for (size_t c = 0; c < channelTypes.size (); ++c)
+        {
+            level.pixelData.push_back (pool.allocate (
+                numPixels * (channelTypes[c] == EXR_PIXEL_HALF ? 2 : 4)));
+        }
+        totalPixels += numPixels;
+    }
+
+    //
+    // decode
+    //
+    steady_clock::time_point startRead = steady_clock::now ();
+    {
+        Decoders decoders (in.ctxt, numThreads);
+
+        parallelFor (
+            static_cast<int> (chunks.size ()),
+            numThreads,
+            [&] (int t, int i) {
+                TraceSpan span ("decode chunk", "chunk", "chunk", i);
+
+                const Chunk&           chunk = chunks[i];
+                const Level&           level = levels[chunk.level];
+                exr_decode_pipeline_t& decode = decoders.pipes[t];
+                exr_chunk_info_t       cinfo;
+
+                if (tiled)
+                {
+                    check (
+                        exr_read_tile_chunk_info (
+                            in.ctxt,
+                            part,
+                            chunk.tileX,
+                            chunk.tileY,
+                            level.levelX,
+                            level.levelY,
+                            &cinfo),
+                        "exr_read_tile_chunk_info");
+                }
+                else
+                {
+                    check (
+                        exr_read_scanline_chunk_info (
+                            in.ctxt, part, chunk.tileY, &cinfo),
+                        "exr_read_scanline_chunk_info");
+                }
+
+                if (!decoders.started[t])
+                {
+                    check (
+                        exr_decoding_initialize (in.ctxt, part, &cinfo, &decode),
+                        "exr_decoding_initialize");
+                    decoders.started[t] = 1;
+                }
+                else
+                {
+                    check (
+                        exr_decoding_update (in.ctxt, part, &cinfo, &decode),
+                        "exr_decoding_update");
+                }
+
+                bindChannels (
+                    decode.channels,
+                    decode.channel_count,
+                    channelIndex,
+                    channelTypes,
+                    levels[chunk.level],
+                    chunk);
+                check (
+                    exr_decoding_choose_default_routines (in.ctxt, part, &decode),
+                    "exr_decoding_choose_default_routines");
+                check (
+                    exr_decoding_run (in.ctxt, part, &decode),
+                    "exr_decoding_run");
+            });
+    }
+    steady_clock::time_point endRead = steady_clock::now ();
+
+    //
+    // set up the output part: our channel types and compression, everything
+    // else copied from the input part
+    //
+    CoreContext out;
+    check (
+        exr_start_write (&out.ctxt, outFileName, EXR_WRITE_FILE_DIRECTLY, &init),
+        "exr_start_write");
+
+    int outPart;
+    check (
+        exr_add_part (
+            out.ctxt,
+            outHeader.hasName () ? outHeader.name ().c_str () : nullptr,
+            storage,
+            &outPart),
+        "exr_add_part");
+    check (
+        exr_set_compression (
+            out.ctxt,
+            outPart,
+            static_cast<exr_compression_t> (outHeader.compression ())),
+        "exr_set_compression");
+    for (ChannelList::ConstIterator i = outHeader.channels ().begin ();
+         i != outHeader.channels ().end ();
+         ++i)
+    {
+        check (
+            exr_add_channel (
+                out.ctxt,
+                outPart,
+                i.name (),
+                static_cast<exr_pixel_type_t> (i.channel ().type),
+                i.channel ().pLinear ? EXR_PERCEPTUALLY_LINEAR
+                                     : EXR_PERCEPTUALLY_LOGARITHMIC,
+                i.channel ().xSampling,
+                i.channel ().ySampling),
+            "exr_add_channel");
+    }
+    check (
+        exr_copy_unset_attributes (out.ctxt, outPart, in.ctxt, part),
+        "exr_copy_unset_attributes");
+
+    switch (outHeader.compression ())
+    {
+        case ZIP_COMPRESSION:
+        case ZIPS_COMPRESSION:
+            check (
+                exr_set_zip_compression_level (
+                    out.ctxt, outPart, outHeader.zipCompressionLevel ()),
+                "exr_set_zip_compression_level");
+            break;
+        case DWAA_COMPRESSION:
+        case DWAB_COMPRESSION:
+            check (
+                exr_set_dwa_compression_level (
+                    out.ctxt, outPart, outHeader.dwaCompressionLevel ()),
+                "exr_set_dwa_compression_level");
+            break;
+        default: break;
+    }
+    check (exr_write_header (out.ctxt), "exr_write_header");
+
+    //
+    // the output's scan line chunks follow its own compression, so they
+    // can cover more or fewer lines than the input's; each encodes its own
+    // lines of the decoded level. Tiles keep the input's tile description.
+    //
+    vector<Chunk> outChunks = chunks;
+    if (!tiled)
+    {
+        int32_t linesPerChunk;
+        check (
+            exr_get_scanlines_per_chunk (out.ctxt, outPart, &linesPerChunk),
+            "exr_get_scanlines_per_chunk");
+
+        outChunks.clear ();
+        for (int64_t y = 0; y < levels[0].height; y += linesPerChunk)
+        {
+            outChunks.push_back (
+                {0, 0, static_cast<int> (dw.min.y + y), 0, static_cast<int> (y)});
+        }
+    }
+
+    exr_lineorder_t lineOrder;
+    check (
+        exr_get_lineorder (out.ctxt, outPart, &lineOrder), "exr_get_lineorder");
+
+    //
+    // encode
+    //
+    steady_clock::time_point startWrite = steady_clock::now ();
+    {
+        vector<exr_chunk_info_t> cinfo (outChunks.size ());
+        for (size_t i = 0; i < outChunks.size (); ++i)
+        {
+            const Chunk& chunk = outChunks[i];
+            const Level& level = levels[chunk.level];
+            if (tiled)
+            {
+                check (
+                    exr_write_tile_chunk_info (
+                        out.ctxt,
+                        outPart,
+                        chunk.tileX,
+                        chunk.tileY,
+                        level.levelX,
+                        level.levelY,
+                        &cinfo[i]),
+                    "exr_write_tile_chunk_info");
+            }
+            else
+            {
+                check (
+                    exr_write_scanline_chunk_info (
+                        out.ctxt, outPart, chunk.tileY, &cinfo[i]),
+                    "exr_write_scanline_chunk_info");
+            }
+        }
+
+        //
+        // chunks must reach the file in the order of the line order
+        //
+        vector<int> sequence = fileOrder (outChunks, lineOrder);
+
+        OrderedWriter writer;
+        writer.ctxt  = out.ctxt;
+        writer.part  = outPart;
+        writer.tiled = tiled;
+
+        Encoders          encoders (out.ctxt, numThreads);
+        vector<EncodeJob> jobs (numThreads);
+
+        parallelFor (
+            static_cast<int> (outChunks.size ()),
+            numThreads,
+            [&] (int t, int s) {
+                try
+                {
+                    int                    i      = sequence[s];
+                    exr_encode_pipeline_t& encode = encoders.pipes[t];
+                    TraceSpan span ("encode chunk", "chunk", "chunk", i);
+
+                    if (!encoders.started[t])
+                    {
+                        check (
+                            exr_encoding_initialize (
+                                out.ctxt, outPart, &cinfo[i], &encode),
+                            "exr_encoding_initialize");
+                        encoders.started[t] = 1;
+                    }
+                    else
+                    {
+                        check (
+                            exr_encoding_update (
+                                out.ctxt, outPart, &cinfo[i], &encode),
+                            "exr_encoding_update");
+                    }
+
+                    bindChannels (
+                        encode.channels,
+                        encode.channel_count,
+                        channelIndex,
+                        channelTypes,
+                        levels[outChunks[i].level],
+                        outChunks[i]);
+                    check (
+                        exr_encoding_choose_default_routines (
+                            out.ctxt, outPart, &encode),
+                        "exr_encoding_choose_default_routines");
+
+                    jobs[t]                   = {&writer, s, &outChunks[i]};
+                    encode.encoding_user_data = &jobs[t];
+                    encode.write_fn           = writeInOrder;
+
+                    check (
+                        exr_encoding_run (out.ctxt, outPart, &encode),
+                        "exr_encoding_run");
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock (writer.mutex);
+                    writer.failed = true;
+                    writer.turn.notify_all ();
+                    throw;
+                }
+            });
+    }
+    steady_clock::time_point endWrite = steady_clock::now ();
+
+    CoreMetrics metrics;
+    metrics.readTime   = timing (startRead, endRead);
+    metrics.writeTime  = timing (startWrite, endWrite);
+    metrics.chunkCount = chunks.size ();
+    metrics.pixelCount = totalPixels;
+    metrics.threads    = numThreads;
+    return metrics;
+}
@@ -0,0 +1,30 @@
+
+#ifndef INCLUDED_EXR_CORE_H
+#define INCLUDED_EXR_CORE_H
+
+//----------------------------------------------------------------------------
+//
+//	Copy a part through the OpenEXRCore C API, without the C++ wrappers
+//
+//----------------------------------------------------------------------------
+
+#include "exrmetrics.h"
+
+#include "ImfHeader.h"
+
+/// Decode all chunks of a scanline or tiled part of inFileName with
+/// exr_decoding_*, then encode the image to a single part outFileName with
+/// exr_encoding_*, using outHeader for channel types and compression, in
+/// the scan line chunks that compression calls for.
+/// Pixel buffers come from pool, which the caller releases.
+/// Chunks are spread over numThreads loop workers on the IlmThread global
+/// pool; the library itself runs no tasks on it.
+CoreMetrics copyCore (
+    const char         inFileName[],
+    int                part,
+    const char         outFileName[],
+    const Imf::Header& outHeader,
+    BufferPool&        pool,
+    int                numThreads);
+
+#endif
@@ -5,6 +5,14 @@
 //
 
 #include "exrmetrics.h"
+#include "bufferpool.h"
+#include "deepflatten.h"
+#include "exrcore.h"
+#include "halfconvert.h"
+#include "memstream.h"
+#include "mipfilter.h"
+#include "parallel.h"
+#include "trace.h"
 
 #include "ImfChannelList.h"
 #include "ImfDeepFrameBuffer.h"
@@ -19,23 +27,25 @@
 #include "ImfMultiPartOutputFile.h"
 #include "ImfOutputPart.h"
 #include "ImfPartType.h"
+#include "ImfThreading.h"
 #include "ImfTiledInputPart.h"
 #include "ImfTiledOutputPart.h"
 
+#include <algorithm>
 #include <chrono>
 #include <ctime>
 #include <list>
 #include <stdexcept>
 #include <vector>
+#include <fnmatch.h>
+#include <string.h>
 #include <sys/stat.h>
 
 using namespace Imf;
 using Imath::Box2i;
 
-using std::cerr;
 using namespace std::chrono;
 using std::chrono::steady_clock;
-using std::cout;
 using std::endl;
 using std::list;
 using std::runtime_error;
@@ -198,6 +208,14 @@ getCompressionNamesString (const std::string& separator, std::string& str)
     str += IdToDesc[i].name;
 }
 
+/// Return true if a compression id is a lossy algorithm, false otherwise.
+bool
+isLossyCompression (Compression id)
+{
+    if (id < NO_COMPRESSION || id >= NUM_COMPRESSION_METHODS) return false;
+    return IdToDesc[static_cast<int> (id)].lossy;
+}
+
 #endif
 
 
@@ -260,40 +278,54 @@ channelCount (const Header& h)
     return channels;
 }
 
-void
-copyScanLine (InputPart& in, OutputPart& out)
+//
+// Allocate a buffer from pool for each channel in header covering dw and
+// insert a slice for it into buf. Returns the number of bytes per pixel.
+//
+int
+allocateFrameBuffer (
+    BufferPool&   pool,
+    const Header& header,
+    const Box2i&  dw,
+    FrameBuffer&  buf)
 {
-    Box2i    dw        = in.header ().dataWindow ();
     uint64_t width     = dw.max.x + 1 - dw.min.x;
     uint64_t height    = dw.max.y + 1 - dw.min.y;
     uint64_t numPixels = width * height;
-    int      numChans  = channelCount (in.header ());
-
-    vector<vector<char>> pixelData (numChans);
     uint64_t offsetToOrigin = width * static_cast<uint64_t> (dw.min.y) +
                               static_cast<uint64_t> (dw.min.x);
 
-    int         channelNumber = 0;
-    int         pixelSize     = 0;
-    FrameBuffer buf;
-
-    for (ChannelList::ConstIterator i = out.header ().channels ().begin ();
-         i != out.header ().channels ().end ();
+    int pixelSize = 0;
+    for (ChannelList::ConstIterator i = header.channels ().begin ();
+         i != header.channels ().end ();
          ++i)
     {
-        int samplesize = pixelTypeSize (i.channel ().type);
-        pixelData[channelNumber].resize (numPixels * samplesize);
+        int   samplesize = pixelTypeSize (i.channel ().type);
+        char* pixelData  = pool.allocate (numPixels * samplesize);
 
         buf.insert (
             i.name (),
             Slice (
                 i.channel ().type,
-                pixelData[channelNumber].data () - offsetToOrigin * samplesize,
+                pixelData - offsetToOrigin * samplesize,
                 samplesize,
                 samplesize * width));
-        ++channelNumber;
         pixelSize += samplesize;
     }
+    return pixelSize;
+}
+
+void
+copyScanLine (
+    InputPart& in, OutputPart& out, BufferPool& pool, CopyMetrics& metrics)
+{
+    Box2i    dw        = in.header ().dataWindow ();
+    uint64_t width     = dw.max.x + 1 - dw.min.x;
+    uint64_t height    = dw.max.y + 1 - dw.min.y;
+    uint64_t numPixels = width * height;
+
+    FrameBuffer buf;
+    int         pixelSize = allocateFrameBuffer (pool, out.header (), dw, buf);
 
     in.setFrameBuffer (buf);
     out.setFrameBuffer (buf);
@@ -301,21 +333,27 @@ copyScanLine (InputPart& in, OutputPart& out)
     steady_clock::time_point startRead = steady_clock::now();
     in.readPixels (dw.min.y, dw.max.y);
     steady_clock::time_point endRead = steady_clock::now();
+    traceSpan ("read", "phase", startRead, endRead);
 
     steady_clock::time_point startWrite = steady_clock::now();
     out.writePixels (height);
     steady_clock::time_point endWrite = steady_clock::now();
+    traceSpan ("write", "phase", startWrite, endWrite);
 
-    cout << "   \"read time\": " << timing (startRead, endRead) << ",\n";
-    cout << "   \"write time\": " << timing (startWrite, endWrite) << ",\n";
-    cout << "   \"pixel count\": " << numPixels << ",\n";
-    cout << "   \"raw size\": " << numPixels * pixelSize << ",\n";
+    metrics.readTime   = timing (startRead, endRead);
+    metrics.writeTime  = timing (startWrite, endWrite);
+    metrics.pixelCount = numPixels;
+    metrics.rawSize    = numPixels * pixelSize;
+    metrics.bufferSize = metrics.rawSize;
 }
 
 void
-copyTiled (TiledInputPart& in, TiledOutputPart& out)
+copyTiled (
+    TiledInputPart&  in,
+    TiledOutputPart& out,
+    BufferPool&      pool,
+    CopyMetrics&     metrics)
 {
-    int             numChans = channelCount (in.header ());
     TileDescription tiling   = in.header ().tileDescription ();
 
     Box2i imageDw = in.header ().dataWindow ();
@@ -332,8 +370,7 @@ copyTiled (TiledInputPart& in, TiledOutputPart& out)
             throw runtime_error ("unknown tile mode");
     }
 
-    vector<vector<vector<char>>> pixelData (totalLevels);
-    vector<FrameBuffer>          frameBuffer (totalLevels);
+    vector<FrameBuffer> frameBuffer (totalLevels);
 
     int    levelIndex  = 0;
     int    pixelSize   = 0;
@@ -358,36 +395,10 @@ copyTiled (TiledInputPart& in, TiledOutputPart& out)
                     yLevel);
                 uint64_t width     = dw.max.x + 1 - dw.min.x;
                 uint64_t height    = dw.max.y + 1 - dw.min.y;
-                uint64_t numPixels = width * height;
-                uint64_t offsetToOrigin =
-                    width * static_cast<uint64_t> (dw.min.y) +
-                    static_cast<uint64_t> (dw.min.x);
-                int channelNumber = 0;
-                pixelSize         = 0;
-
-                pixelData[levelIndex].resize (numChans);
-
-                for (ChannelList::ConstIterator i =
-                         out.header ().channels ().begin ();
-                     i != out.header ().channels ().end ();
-                     ++i)
-                {
-                    int samplesize = pixelTypeSize (i.channel ().type);
-                    pixelData[levelIndex][channelNumber].resize (
-                        numPixels * samplesize);
-
-                    frameBuffer[levelIndex].insert (
-                        i.name (),
-                        Slice (
-                            i.channel ().type,
-                            pixelData[levelIndex][channelNumber].data () -
-                                offsetToOrigin * samplesize,
-                            samplesize,
-                            samplesize * width));
-                    ++channelNumber;
-                    pixelSize += samplesize;
-                }
-                totalPixels += numPixels;
+
+                pixelSize = allocateFrameBuffer (
+                    pool, out.header (), dw, frameBuffer[levelIndex]);
+                totalPixels += width * height;
                 ++levelIndex;
             }
         }
@@ -416,6 +427,7 @@ copyTiled (TiledInputPart& in, TiledOutputPart& out)
     }
 
     steady_clock::time_point endRead = steady_clock::now();
+    traceSpan ("read", "phase", startRead, endRead);
 
     steady_clock::time_point startWrite = steady_clock::now();
     levelIndex         = 0;
@@ -441,33 +453,278 @@ copyTiled (TiledInputPart& in, TiledOutputPart& out)
         }
     }
     steady_clock::time_point endWrite = steady_clock::now();
+    traceSpan ("write", "phase", startWrite, endWrite);
+
+    metrics.readTime   = timing (startRead, endRead);
+    metrics.writeTime  = timing (startWrite, endWrite);
+    metrics.tileCount  = tileCount;
+    metrics.pixelCount = totalPixels;
+    metrics.rawSize    = totalPixels * pixelSize;
+    metrics.bufferSize = metrics.rawSize;
+}
+
+//
+// Call fn (first, count) for blocks of n values, spread over the same
+// number of threads the library decodes with
+//
+template <class Function>
+void
+forBlocks (uint64_t n, Function fn)
+{
+    const uint64_t blockSize = 1 << 16;
+    int blocks = static_cast<int> ((n + blockSize - 1) / blockSize);
+    parallelFor (blocks, globalThreadCount (), [&] (int, int b) {
+        uint64_t first = b * blockSize;
+        fn (first, std::min (blockSize, n - first));
+    });
+}
+
+//
+// One channel of a band buffer
+//
+struct BandPlane
+{
+    string    name;
+    PixelType type;
+    int       sampleSize;
+    char*     data;
+};
+
+//
+// Allocate a buffer from pool for each channel in header, width pixels
+// wide and lines high. Returns the number of bytes per pixel.
+//
+int
+allocateBand (
+    BufferPool&        pool,
+    const Header&      header,
+    uint64_t           width,
+    uint64_t           lines,
+    vector<BandPlane>& planes)
+{
+    int pixelSize = 0;
+    for (ChannelList::ConstIterator i = header.channels ().begin ();
+         i != header.channels ().end ();
+         ++i)
+    {
+        int samplesize = pixelTypeSize (i.channel ().type);
+        planes.push_back (
+            {i.name (),
+             i.channel ().type,
+             samplesize,
+             pool.allocate (width * lines * samplesize)});
+        pixelSize += samplesize;
+    }
+    return pixelSize;
+}
+
+//
+// A frame buffer whose first line y0 and first column x0 fall at the start
+// of planes, which are width pixels wide
+//
+FrameBuffer
+bandFrameBuffer (
+    const vector<BandPlane>& planes, int x0, int y0, uint64_t width)
+{
+    int64_t     offsetToOrigin = int64_t (width) * y0 + x0;
+    FrameBuffer buf;
+    for (const BandPlane& p: planes)
+    {
+        buf.insert (
+            p.name,
+            Slice (
+                p.type,
+                p.data - offsetToOrigin * p.sampleSize,
+                p.sampleSize,
+                p.sampleSize * width));
+    }
+    return buf;
+}
+
+//
+// Copy a scanline part a band of whole chunks at a time through one band
+// sized buffer, repointing the frame buffer at each band in turn, so memory
+// is proportional to the band rather than to the image. Bands follow the
+// output line order so the library never holds lines back.
+//
+void
+copyScanLineBanded (
+    InputPart&   in,
+    OutputPart&  out,
+    int          band,
+    BufferPool&  pool,
+    CopyMetrics& metrics)
+{
+    Box2i    dw     = in.header ().dataWindow ();
+    uint64_t width  = dw.max.x + 1 - dw.min.x;
+    uint64_t height = dw.max.y + 1 - dw.min.y;
+
+    //
+    // chunks of either file start at dw.min.y, and the larger chunk height
+    // is a multiple of the smaller one
+    //
+    int chunkLines = std::max (
+        getCompressionNumScanlines (in.header ().compression ()),
+        getCompressionNumScanlines (out.header ().compression ()));
+    int lines = static_cast<int> (
+        std::min (uint64_t (band) * std::max (chunkLines, 1), height));
+    int bands = static_cast<int> ((height + lines - 1) / lines);
+
+    vector<BandPlane> planes;
+    int  pixelSize  = allocateBand (pool, out.header (), width, lines, planes);
+    bool decreasing = out.header ().lineOrder () == DECREASING_Y;
+
+    double readTime  = 0;
+    double writeTime = 0;
+    for (int b = 0; b < bands; ++b)
+    {
+        int y0 = dw.min.y + (decreasing ? bands - 1 - b : b) * lines;
+        int y1 = std::min (y0 + lines - 1, dw.max.y);
+
+        FrameBuffer buf = bandFrameBuffer (planes, dw.min.x, y0, width);
+        in.setFrameBuffer (buf);
+        out.setFrameBuffer (buf);
+
+        steady_clock::time_point startRead = steady_clock::now ();
+        in.readPixels (y0, y1);
+        steady_clock::time_point endRead = steady_clock::now ();
+        traceSpan ("read", "phase", startRead, endRead, "band", b);
+
+        steady_clock::time_point startWrite = steady_clock::now ();
+        out.writePixels (y1 + 1 - y0);
+        steady_clock::time_point endWrite = steady_clock::now ();
+        traceSpan ("write", "phase", startWrite, endWrite, "band", b);
+
+        readTime += timing (startRead, endRead);
+        writeTime += timing (startWrite, endWrite);
+    }
+
+    metrics.readTime   = readTime;
+    metrics.writeTime  = writeTime;
+    metrics.pixelCount = width * height;
+    metrics.rawSize    = width * height * pixelSize;
+    metrics.band       = band;
+    metrics.bufferSize = width * lines * pixelSize;
+}
+
+//
+// Copy a tiled part a band of tile rows at a time, level by level, through
+// one buffer as wide as level 0, as copyScanLineBanded does. Levels and
+// tile rows are visited in the order the output stores them.
+//
+void
+copyTiledBanded (
+    TiledInputPart&  in,
+    TiledOutputPart& out,
+    int              band,
+    BufferPool&      pool,
+    CopyMetrics&     metrics)
+{
+    TileDescription tiling  = in.header ().tileDescription ();
+    Box2i           imageDw = in.header ().dataWindow ();
+    uint64_t        width   = imageDw.max.x + 1 - imageDw.min.x;
+    uint64_t        height  = imageDw.max.y + 1 - imageDw.min.y;
+    uint64_t bandLines = std::min (uint64_t (band) * tiling.ySize, height);
+
+    vector<BandPlane> planes;
+    int  pixelSize =
+        allocateBand (pool, out.header (), width, bandLines, planes);
+    bool decreasing = out.header ().lineOrder () == DECREASING_Y;
+
+    double   readTime    = 0;
+    double   writeTime   = 0;
+    int      tileCount   = 0;
+    uint64_t totalPixels = 0;
+    for (int yLevel = 0; yLevel < in.numYLevels (); ++yLevel)
+    {
+        for (int xLevel = 0; xLevel < in.numXLevels (); ++xLevel)
+        {
+            if (tiling.mode != RIPMAP_LEVELS && xLevel != yLevel) { continue; }
+
+            Box2i dw = dataWindowForLevel (
+                tiling,
+                imageDw.min.x,
+                imageDw.max.x,
+                imageDw.min.y,
+                imageDw.max.y,
+                xLevel,
+                yLevel);
+            uint64_t levelWidth = dw.max.x + 1 - dw.min.x;
+            int      numXTiles  = in.numXTiles (xLevel);
+            int      numYTiles  = in.numYTiles (yLevel);
+            int      bands      = (numYTiles + band - 1) / band;
+
+            for (int b = 0; b < bands; ++b)
+            {
+                int ty0 = (decreasing ? bands - 1 - b : b) * band;
+                int ty1 = std::min (ty0 + band - 1, numYTiles - 1);
+                int y0  = dw.min.y + ty0 * tiling.ySize;
+
+                FrameBuffer buf =
+                    bandFrameBuffer (planes, dw.min.x, y0, levelWidth);
+                in.setFrameBuffer (buf);
+                out.setFrameBuffer (buf);
+
+                steady_clock::time_point startRead = steady_clock::now ();
+                in.readTiles (0, numXTiles - 1, ty0, ty1, xLevel, yLevel);
+                steady_clock::time_point endRead = steady_clock::now ();
+                traceSpan ("read", "phase", startRead, endRead, "band", b);
+
+                steady_clock::time_point startWrite = steady_clock::now ();
+                out.writeTiles (0, numXTiles - 1, ty0, ty1, xLevel, yLevel);
+                steady_clock::time_point endWrite = steady_clock::now ();
+                traceSpan ("write", "phase", startWrite, endWrite, "band", b);
+
+                readTime += timing (startRead, endRead);
+                writeTime += timing (startWrite, endWrite);
+            }
+
+            tileCount += numXTiles * numYTiles;
+            totalPixels += levelWidth * (dw.max.y + 1 - dw.min.y);
+        }
+    }
 
-    cout << "   \"read time\": " << timing (startRead, endRead) << ",\n";
-    cout << "   \"write time\": " << timing (startWrite, endWrite) << ",\n";
-    cout << "   \"total tiles\": " << tileCount << ",\n";
-    cout << "   \"pixel count\": " << totalPixels << ",\n";
-    cout << "   \"raw size\": " << totalPixels * pixelSize << ",\n";
+    metrics.readTime   = readTime;
+    metrics.writeTime  = writeTime;
+    metrics.tileCount  = tileCount;
+    metrics.pixelCount = totalPixels;
+    metrics.rawSize    = totalPixels * pixelSize;
+    metrics.band       = band;
+    metrics.bufferSize = width * bandLines * pixelSize;
 }
 
+void flattenSamples (
+    const Header&         header,
+    const int*            sampleCount,
+    const vector<char**>& pixelPtrs,
+    const Settings&       settings,
+    BufferPool&           pool,
+    CopyMetrics&          metrics);
+
 void
-copyDeepScanLine (DeepScanLineInputPart& in, DeepScanLineOutputPart& out)
+copyDeepScanLine (
+    DeepScanLineInputPart&  in,
+    DeepScanLineOutputPart& out,
+    const Settings&         settings,
+    BufferPool&             pool,
+    CopyMetrics&            metrics)
 {
     Box2i       dw        = in.header ().dataWindow ();
     uint64_t    width     = dw.max.x + 1 - dw.min.x;
     uint64_t    height    = dw.max.y + 1 - dw.min.y;
     uint64_t    numPixels = width * height;
     int         numChans  = channelCount (in.header ());
-    vector<int> sampleCount (numPixels);
+    int*        sampleCount = pool.allocate<int> (numPixels);
 
     uint64_t offsetToOrigin = width * static_cast<uint64_t> (dw.min.y) +
                               static_cast<uint64_t> (dw.min.x);
-    vector<vector<char*>> pixelPtrs (numChans);
+    vector<char**> pixelPtrs (numChans);
 
     DeepFrameBuffer buffer;
 
     buffer.insertSampleCountSlice (Slice (
         UINT,
-        (char*) (sampleCount.data () - offsetToOrigin),
+        (char*) (sampleCount - offsetToOrigin),
         sizeof (int),
         sizeof (int) * width));
     int channelNumber  = 0;
@@ -476,13 +733,13 @@ copyDeepScanLine (DeepScanLineInputPart& in, DeepScanLineOutputPart& out)
          i != out.header ().channels ().end ();
          ++i)
     {
-        pixelPtrs[channelNumber].resize (numPixels);
+        pixelPtrs[channelNumber] = pool.allocate<char*> (numPixels);
         int samplesize = pixelTypeSize (i.channel ().type);
         buffer.insert (
             i.name (),
             DeepSlice (
                 i.channel ().type,
-                (char*) (pixelPtrs[channelNumber].data () - offsetToOrigin),
+                (char*) (pixelPtrs[channelNumber] - offsetToOrigin),
                 sizeof (char*),
                 sizeof (char*) * width,
                 samplesize));
@@ -496,27 +753,28 @@ copyDeepScanLine (DeepScanLineInputPart& in, DeepScanLineOutputPart& out)
     steady_clock::time_point startCountRead = steady_clock::now();
     in.readPixelSampleCounts (dw.min.y, dw.max.y);
     steady_clock::time_point endCountRead = steady_clock::now();
+    traceSpan ("count read", "phase", startCountRead, endCountRead);
 
     size_t totalSamples = 0;
 
-    for (int i: sampleCount)
+    for (uint64_t p = 0; p < numPixels; ++p)
     {
-        totalSamples += i;
+        totalSamples += sampleCount[p];
     }
 
-    vector<vector<char>> sampleData (numChans);
+    vector<char*> sampleData (numChans);
     channelNumber = 0;
     for (ChannelList::ConstIterator i = in.header ().channels ().begin ();
          i != in.header ().channels ().end ();
          ++i)
     {
         int samplesize = pixelTypeSize (i.channel ().type);
-        sampleData[channelNumber].resize (samplesize * totalSamples);
+        sampleData[channelNumber] = pool.allocate (samplesize * totalSamples);
         int offset = 0;
         for (uint64_t p = 0; p < numPixels; ++p)
         {
             pixelPtrs[channelNumber][p] =
-                sampleData[channelNumber].data () + offset * samplesize;
+                sampleData[channelNumber] + offset * samplesize;
             offset += sampleCount[p];
         }
 
@@ -526,25 +784,39 @@ copyDeepScanLine (DeepScanLineInputPart& in, DeepScanLineOutputPart& out)
     steady_clock::time_point startSampleRead = steady_clock::now();
     in.readPixels (dw.min.y, dw.max.y);
     steady_clock::time_point endSampleRead = steady_clock::now();
+    traceSpan ("sample read", "phase", startSampleRead, endSampleRead);
+
+    if (settings.flatten)
+    {
+        flattenSamples (
+            out.header (), sampleCount, pixelPtrs, settings, pool, metrics);
+    }
 
 
     steady_clock::time_point startWrite = steady_clock::now();
     out.writePixels (height);
     steady_clock::time_point endWrite = steady_clock::now();
-
-
-    cout << "   \"count read time\": " << timing (startCountRead, endCountRead)
-         << ",\n";
-    cout << "   \"sample read time\": "
-         << timing (startSampleRead, endSampleRead) << ",\n";
-    cout << "   \"write time\": " << timing (startWrite, endWrite) << ",\n";
-    cout << "   \"pixel count\": " << numPixels << ",\n";
-    cout << "   \"raw size\": "
-         << totalSamples * bytesPerSample + numPixels * sizeof (int) << ",\n";
+    traceSpan ("write", "phase", startWrite, endWrite);
+
+
+    metrics.countReadTime  = timing (startCountRead, endCountRead);
+    metrics.sampleReadTime = timing (startSampleRead, endSampleRead);
+    metrics.writeTime      = timing (startWrite, endWrite);
+    metrics.pixelCount     = numPixels;
+    metrics.sampleCount    = totalSamples;
+    metrics.rawSize =
+        totalSamples * bytesPerSample + numPixels * sizeof (int);
+    metrics.bufferSize =
+        metrics.rawSize + numPixels * numChans * sizeof (char*);
 }
 
 void
-copyDeepTiled (DeepTiledInputPart& in, DeepTiledOutputPart& out)
+copyDeepTiled (
+    DeepTiledInputPart&  in,
+    DeepTiledOutputPart& out,
+    const Settings&      settings,
+    BufferPool&          pool,
+    CopyMetrics&         metrics)
 {
 
     TileDescription tiling = in.header ().tileDescription ();
@@ -566,17 +838,17 @@ copyDeepTiled (DeepTiledInputPart& in, DeepTiledOutputPart& out)
     uint64_t    height    = dw.max.y + 1 - dw.min.y;
     uint64_t    numPixels = width * height;
     int         numChans  = channelCount (in.header ());
-    vector<int> sampleCount (numPixels);
+    int*        sampleCount = pool.allocate<int> (numPixels);
 
     uint64_t offsetToOrigin = width * static_cast<uint64_t> (dw.min.y) +
                               static_cast<uint64_t> (dw.min.x);
-    vector<vector<char*>> pixelPtrs (numChans);
+    vector<char**> pixelPtrs (numChans);
 
     DeepFrameBuffer buffer;
 
     buffer.insertSampleCountSlice (Slice (
         UINT,
-        (char*) (sampleCount.data () - offsetToOrigin),
+        (char*) (sampleCount - offsetToOrigin),
         sizeof (int),
         sizeof (int) * width));
     int channelNumber  = 0;
@@ -585,13 +857,13 @@ copyDeepTiled (DeepTiledInputPart& in, DeepTiledOutputPart& out)
          i != out.header ().channels ().end ();
          ++i)
     {
-        pixelPtrs[channelNumber].resize (numPixels);
+        pixelPtrs[channelNumber] = pool.allocate<char*> (numPixels);
         int samplesize = pixelTypeSize (i.channel ().type);
         buffer.insert (
             i.name (),
             DeepSlice (
                 i.channel ().type,
-                (char*) (pixelPtrs[channelNumber].data () - offsetToOrigin),
+                (char*) (pixelPtrs[channelNumber] - offsetToOrigin),
                 sizeof (char*),
                 sizeof (char*) * width,
                 samplesize));
@@ -607,28 +879,29 @@ copyDeepTiled (DeepTiledInputPart& in, DeepTiledOutputPart& out)
     in.readPixelSampleCounts (
         0, in.numXTiles (0) - 1, 0, in.numYTiles (0) - 1, 0, 0);
     steady_clock::time_point endCountRead = steady_clock::now();
+    traceSpan ("count read", "phase", startCountRead, endCountRead);
 
 
     size_t totalSamples = 0;
 
-    for (int i: sampleCount)
+    for (uint64_t p = 0; p < numPixels; ++p)
     {
-        totalSamples += i;
+        totalSamples += sampleCount[p];
     }
 
-    vector<vector<char>> sampleData (numChans);
+    vector<char*> sampleData (numChans);
     channelNumber = 0;
     for (ChannelList::ConstIterator i = in.header ().channels ().begin ();
          i != in.header ().channels ().end ();
          ++i)
     {
         int samplesize = pixelTypeSize (i.channel ().type);
-        sampleData[channelNumber].resize (samplesize * totalSamples);
+        sampleData[channelNumber] = pool.allocate (samplesize * totalSamples);
         int offset = 0;
         for (uint64_t p = 0; p < numPixels; ++p)
         {
             pixelPtrs[channelNumber][p] =
-                sampleData[channelNumber].data () + offset * samplesize;
+                sampleData[channelNumber] + offset * samplesize;
             offset += sampleCount[p];
         }
 
@@ -638,148 +911,1753 @@ copyDeepTiled (DeepTiledInputPart& in, DeepTiledOutputPart& out)
     steady_clock::time_point startSampleRead = steady_clock::now();
     in.readTiles (0, in.numXTiles (0) - 1, 0, in.numYTiles (0) - 1, 0, 0);
     steady_clock::time_point endSampleRead = steady_clock::now();
+    traceSpan ("sample read", "phase", startSampleRead, endSampleRead);
+
+    if (settings.flatten)
+    {
+        flattenSamples (
+            out.header (), sampleCount, pixelPtrs, settings, pool, metrics);
+    }
 
     steady_clock::time_point startWrite = steady_clock::now();
     out.writeTiles (0, in.numXTiles (0) - 1, 0, in.numYTiles (0) - 1, 0, 0);
     steady_clock::time_point endWrite = steady_clock::now();
+    traceSpan ("write", "phase", startWrite, endWrite);
+
+
+    metrics.countReadTime  = timing (startCountRead, endCountRead);
+    metrics.sampleReadTime = timing (startSampleRead, endSampleRead);
+    metrics.writeTime      = timing (startWrite, endWrite);
+    metrics.pixelCount     = numPixels;
+    metrics.sampleCount    = totalSamples;
+    metrics.rawSize =
+        totalSamples * bytesPerSample + numPixels * sizeof (int);
+    metrics.bufferSize =
+        metrics.rawSize + numPixels * numChans * sizeof (char*);
+}
+
+//
+// Header for writing level 0 of the input part with the given geometry.
+// Level modes are not carried over: only level 0 is ever written.
+//
+Header
+geometryHeader (const Header& outHeader, const OutputGeometry& geometry)
+{
+    Header h = outHeader;
+
+    bool tiled = geometry.layout == OutputGeometry::TILED ||
+                 (geometry.layout == OutputGeometry::RETAIN &&
+                  outHeader.hasTileDescription ());
+
+    if (tiled)
+    {
+        TileDescription tiling;
+        if (outHeader.hasTileDescription ())
+        {
+            tiling = outHeader.tileDescription ();
+        }
+        if (geometry.layout == OutputGeometry::TILED)
+        {
+            tiling.xSize = geometry.tileXSize;
+            tiling.ySize = geometry.tileYSize;
+        }
+        tiling.mode = ONE_LEVEL;
+        h.setTileDescription (tiling);
+        h.setType (TILEDIMAGE);
+    }
+    else
+    {
+        if (h.hasTileDescription ()) { h.erase ("tiles"); }
+        h.setType (SCANLINEIMAGE);
+    }
 
+    if (geometry.lineOrder != NUM_LINEORDERS)
+    {
+        h.lineOrder () = geometry.lineOrder;
+    }
+    else if (!tiled && h.lineOrder () == RANDOM_Y)
+    {
+        h.lineOrder () = INCREASING_Y;
+    }
 
-    cout << "   \"count read time\": " << timing (startCountRead, endCountRead)
-         << ",\n";
-    cout << "   \"sample read time\": "
-         << timing (startSampleRead, endSampleRead) << ",\n";
-    cout << "   \"write time\": " << timing (startWrite, endWrite) << ",\n";
-    cout << "   \"pixel count\": " << numPixels << ",\n";
-    cout << "   \"raw size\": "
-         << totalSamples * bytesPerSample + numPixels * sizeof (int) << ",\n";
+    return h;
 }
 
+//
+// Read level 0 of a scanline or tiled part into buf
+//
 void
-exrmetrics (
-    const char       inFileName[],
-    const char       outFileName[],
-    int              part,
-    Imf::Compression compression,
-    float            level,
-    int              halfMode)
+readLevelZero (MultiPartInputFile& in, int part, const FrameBuffer& buf)
 {
-    MultiPartInputFile in (inFileName);
-    if (part >= in.parts ())
+    const Header& h  = in.header (part);
+    Box2i         dw = h.dataWindow ();
+
+    if (h.type () == TILEDIMAGE)
     {
-        throw runtime_error ((string (inFileName) + " only contains " +
-                              to_string (in.parts ()) +
-                              " parts. Cannot copy part " + to_string (part))
-                                 .c_str ());
+        TiledInputPart inpart (in, part);
+        inpart.setFrameBuffer (buf);
+        inpart.readTiles (
+            0, inpart.numXTiles (0) - 1, 0, inpart.numYTiles (0) - 1, 0, 0);
     }
-    Header outHeader = in.header (part);
+    else
+    {
+        InputPart inpart (in, part);
+        inpart.setFrameBuffer (buf);
+        inpart.readPixels (dw.min.y, dw.max.y);
+    }
+}
 
-    if (compression < NUM_COMPRESSION_METHODS)
+//
+// Write buf as level 0 of the single part of out, returning the time taken
+// by the write calls
+//
+double
+writeLevelZero (MultiPartOutputFile& out, const FrameBuffer& buf)
+{
+    const Header&            h = out.header (0);
+    steady_clock::time_point startWrite;
+
+    if (h.type () == TILEDIMAGE)
     {
-        outHeader.compression () = compression;
+        TiledOutputPart outpart (out, 0);
+        outpart.setFrameBuffer (buf);
+        startWrite = steady_clock::now ();
+        outpart.writeTiles (
+            0, outpart.numXTiles (0) - 1, 0, outpart.numYTiles (0) - 1, 0, 0);
     }
-    else { compression = outHeader.compression (); }
+    else
+    {
+        Box2i       dw = h.dataWindow ();
+        OutputPart outpart (out, 0);
+        outpart.setFrameBuffer (buf);
+        startWrite = steady_clock::now ();
+        outpart.writePixels (dw.max.y + 1 - dw.min.y);
+    }
+    steady_clock::time_point endWrite = steady_clock::now ();
+    traceSpan ("write", "phase", startWrite, endWrite);
+    return timing (startWrite, endWrite);
+}
 
-    if (!isinf (level) && level >= -1)
+double
+writeLevelZero (const char fileName[], const Header& h, const FrameBuffer& buf)
+{
+    MultiPartOutputFile out (fileName, &h, 1);
+    return writeLevelZero (out, buf);
+}
+
+//
+// Read level 0 of a single part file back into buf, returning the time
+// taken by the read calls
+//
+double
+rereadLevelZero (MultiPartInputFile& reread, const FrameBuffer& buf)
+{
+    steady_clock::time_point startReread = steady_clock::now ();
+    readLevelZero (reread, 0, buf);
+    steady_clock::time_point endReread = steady_clock::now ();
+    traceSpan ("reread", "phase", startReread, endReread);
+    return timing (startReread, endReread);
+}
+
+double
+rereadLevelZero (const char fileName[], const FrameBuffer& buf)
+{
+    MultiPartInputFile reread (fileName);
+    return rereadLevelZero (reread, buf);
+}
+
+//
+// Flatten the samples a deep copy decoded, laid out for the channels of
+// header, in a timed stage, and write the flat image as a scanline part
+// if settings name a file for it
+//
+void
+flattenSamples (
+    const Header&         header,
+    const int*            sampleCount,
+    const vector<char**>& pixelPtrs,
+    const Settings&       settings,
+    BufferPool&           pool,
+    CopyMetrics&          metrics)
+{
+    Box2i    dw        = header.dataWindow ();
+    uint64_t width     = dw.max.x + 1 - dw.min.x;
+    uint64_t numPixels = width * (dw.max.y + 1 - dw.min.y);
+
+    vector<DeepChannel> channels;
+    vector<char*>       planes;
+    for (ChannelList::ConstIterator i = header.channels ().begin ();
+         i != header.channels ().end ();
+         ++i)
     {
-        switch (outHeader.compression ())
-        {
-            case DWAA_COMPRESSION:
-            case DWAB_COMPRESSION:
-                outHeader.dwaCompressionLevel () = level;
-                break;
-            case ZIP_COMPRESSION:
-            case ZIPS_COMPRESSION:
-                outHeader.zipCompressionLevel () = level;
-                break;
-                //            case ZSTD_COMPRESSION :
-                //                outHeader.zstdCompressionLevel()=level;
-                //                break;
-            default:
-                throw runtime_error (
-                    "-l option only works for DWAA/DWAB,ZIP/ZIPS or ZSTD compression");
-        }
+        channels.push_back (
+            {i.name (), i.channel ().type, pixelPtrs[channels.size ()]});
+        planes.push_back (pool.allocate (numPixels * sizeof (float)));
     }
 
-    if (halfMode > 0)
+    steady_clock::time_point startFlatten = steady_clock::now ();
+    flattenDeep (
+        sampleCount, numPixels, channels, planes, globalThreadCount ());
+    steady_clock::time_point endFlatten = steady_clock::now ();
+    traceSpan ("flatten", "phase", startFlatten, endFlatten);
+    metrics.flattenTime = timing (startFlatten, endFlatten);
+
+    if (settings.flattenFile.empty ()) { return; }
+
+    //
+    // HALF channels were flattened as float
+    //
+    vector<BandPlane> flat;
+    for (size_t c = 0; c < channels.size (); ++c)
     {
-        for (ChannelList::Iterator i = outHeader.channels ().begin ();
-             i != outHeader.channels ().end ();
-             ++i)
+        PixelType type = channels[c].type;
+        char*     data = planes[c];
+        if (type == HALF)
         {
-            if (halfMode == 2 || !strcmp (i.name (), "R") ||
-                !strcmp (i.name (), "G") || !strcmp (i.name (), "B") ||
-                !strcmp (i.name (), "A"))
-            {
-                i.channel ().type = HALF;
-            }
+            uint16_t*    half  = pool.allocate<uint16_t> (numPixels);
+            const float* plane = reinterpret_cast<const float*> (data);
+            forBlocks (numPixels, [&] (uint64_t first, uint64_t count) {
+                floatToHalf (plane + first, half + first, count);
+            });
+            data = reinterpret_cast<char*> (half);
         }
+        flat.push_back ({channels[c].name, type, pixelTypeSize (type), data});
     }
 
-    string inCompress, outCompress;
-    getCompressionNameFromId (in.header (part).compression (), inCompress);
-    getCompressionNameFromId (outHeader.compression (), outCompress);
-    cout << "{\n";
-    cout << "   \"input compression\": \"" << inCompress << "\",\n";
-    cout << "   \"output compression\": \"" << outCompress << "\",\n";
-    if (compression == ZIP_COMPRESSION || compression == ZIPS_COMPRESSION)
+    OutputGeometry scanline;
+    scanline.layout = OutputGeometry::SCANLINE;
+    metrics.flatWriteTime = writeLevelZero (
+        settings.flattenFile.c_str (),
+        geometryHeader (header, scanline),
+        bandFrameBuffer (flat, dw.min.x, dw.min.y, width));
+}
+
+//
+// Decode level 0 of a scanline or tiled part into buffers with the
+// channel types of outHeader, measuring the read time and sizes
+//
+void
+decodeFlatPart (
+    MultiPartInputFile&   in,
+    int                   part,
+    const Header&         outHeader,
+    const char            mode[],
+    BufferPool&           pool,
+    FrameBuffer&          buf,
+    CopyMetrics&          decode)
+{
+    string type = in.header (part).type ();
+    if (type != SCANLINEIMAGE && type != TILEDIMAGE)
     {
-        cout << "   \"zipCompressionLevel\": "
-             << outHeader.zipCompressionLevel () << ",\n";
+        throw runtime_error (
+            string (mode) + " is only supported for scanline and tiled parts");
     }
 
-    if (compression == DWAA_COMPRESSION || compression == DWAB_COMPRESSION)
+    Box2i    dw        = outHeader.dataWindow ();
+    uint64_t width     = dw.max.x + 1 - dw.min.x;
+    uint64_t height    = dw.max.y + 1 - dw.min.y;
+    uint64_t numPixels = width * height;
+
+    int pixelSize = allocateFrameBuffer (pool, outHeader, dw, buf);
+
+    steady_clock::time_point startRead = steady_clock::now ();
+    readLevelZero (in, part, buf);
+    steady_clock::time_point endRead = steady_clock::now ();
+    traceSpan ("read", "phase", startRead, endRead);
+
+    decode.readTime   = timing (startRead, endRead);
+    decode.pixelCount = numPixels;
+    decode.rawSize    = numPixels * pixelSize;
+}
+
+//
+// Time reading a preview, size pixels on its longer side, of the RGBA
+// channels of a scanline or tiled part of fileName, from opening the file.
+// A tiled part reads the smallest level at least as large as the preview.
+// A scanline part reads every Nth chunk, N as large as still gives a chunk
+// for each preview line, one chunk at a time through a chunk sized buffer,
+// box filtering each down to the lines it contributes. Either is then box
+// filtered to the preview size. If preview is not null it receives the
+// preview, one float plane per channel.
+//
+PreviewMetrics
+previewFile (
+    const char         fileName[],
+    int                part,
+    int                size,
+    BufferPool&        pool,
+    vector<BandPlane>* preview)
+{
+    steady_clock::time_point start = steady_clock::now ();
+
+    MultiPartInputFile in (fileName);
+    if (part >= in.parts ())
     {
-        cout << "   \"dwaCompressionLevel\": "
-             << outHeader.dwaCompressionLevel () << ",\n";
+        throw runtime_error (
+            string (fileName) + " only contains " + to_string (in.parts ()) +
+            " parts. Cannot preview part " + to_string (part));
     }
+    const Header& h = in.header (part);
 
-    std::string type = outHeader.type ();
-    cout << "   \"part type\": \"" << type << "\",\n";
-
-    if (type == SCANLINEIMAGE)
+    PreviewMetrics m;
+    m.partType    = h.type ();
+    m.compression = h.compression ();
+    if (m.partType != SCANLINEIMAGE && m.partType != TILEDIMAGE)
     {
-        cout << "   \"scanlines per chunk:\" : "
-             << getCompressionNumScanlines (compression) << ",\n";
+        throw runtime_error (
+            "--preview is only supported for scanline and tiled parts");
     }
 
+    vector<string> names;
+    for (const char* name: {"R", "G", "B", "A"})
+    {
+        if (h.channels ().findChannel (name)) { names.push_back (name); }
+    }
+    if (names.empty ())
     {
-        MultiPartOutputFile out (outFileName, &outHeader, 1);
+        throw runtime_error ("--preview needs an R, G, B or A channel");
+    }
 
-        if (type == TILEDIMAGE)
-        {
-            TiledInputPart  inpart (in, part);
-            TiledOutputPart outpart (out, 0);
-            copyTiled (inpart, outpart);
-        }
-        else if (type == SCANLINEIMAGE)
-        {
-            InputPart  inpart (in, part);
-            OutputPart outpart (out, 0);
-            copyScanLine (inpart, outpart);
-        }
-        else if (type == DEEPSCANLINE)
-        {
-            DeepScanLineInputPart  inpart (in, part);
-            DeepScanLineOutputPart outpart (out, 0);
-            copyDeepScanLine (inpart, outpart);
-        }
-        else if (type == DEEPTILE)
+    //
+    // the longer side scaled to size, never enlarged
+    //
+    Box2i  dw     = h.dataWindow ();
+    int    width  = dw.max.x + 1 - dw.min.x;
+    int    height = dw.max.y + 1 - dw.min.y;
+    double scale  = std::min (1.0, double (size) / std::max (width, height));
+    m.width       = std::max (1, static_cast<int> (width * scale + 0.5));
+    m.height      = std::max (1, static_cast<int> (height * scale + 0.5));
+
+    //
+    // most of a preview's resamples are small enough that handing them to
+    // the pool would cost more than it saves; they run inline
+    //
+    auto threadsFor = [] (uint64_t numPixels) {
+        const uint64_t inlinePixels = 1 << 18;
+        return numPixels < inlinePixels ? 1
+                                        : std::max (1, globalThreadCount ());
+    };
+
+    vector<BandPlane> source;
+    auto              allocatePlanes =
+        [&] (vector<BandPlane>& planes, uint64_t numPixels) {
+            for (const string& name: names)
+            {
+                planes.push_back (
+                    {name,
+                     FLOAT,
+                     sizeof (float),
+                     pool.allocate (numPixels * sizeof (float))});
+            }
+        };
+
+    if (m.partType == TILEDIMAGE)
+    {
+        TiledInputPart tiled (in, part);
+        steady_clock::time_point startRead = steady_clock::now ();
+        m.openTime = timing (start, startRead);
+
+        //
+        // mip levels shrink both ways at once, rip levels each on its own
+        //
+        if (tiled.levelMode () != ONE_LEVEL)
         {
-            DeepTiledInputPart  inpart (in, part);
-            DeepTiledOutputPart outpart (out, 0);
-            copyDeepTiled (inpart, outpart);
+            while (m.xLevel + 1 < tiled.numXLevels () &&
+                   tiled.levelWidth (m.xLevel + 1) >= m.width)
+            {
+                ++m.xLevel;
+            }
+            while (m.yLevel + 1 < tiled.numYLevels () &&
+                   tiled.levelHeight (m.yLevel + 1) >= m.height)
+            {
+                ++m.yLevel;
+            }
+            if (tiled.levelMode () == MIPMAP_LEVELS)
+            {
+                m.xLevel = m.yLevel = std::min (m.xLevel, m.yLevel);
+            }
         }
-        else
+
+        Box2i levelWindow = tiled.dataWindowForLevel (m.xLevel, m.yLevel);
+        m.sourceWidth     = levelWindow.max.x + 1 - levelWindow.min.x;
+        m.sourceHeight    = levelWindow.max.y + 1 - levelWindow.min.y;
+        m.chunkCount =
+            tiled.numXTiles (m.xLevel) * tiled.numYTiles (m.yLevel);
+
+        allocatePlanes (source, uint64_t (m.sourceWidth) * m.sourceHeight);
+        tiled.setFrameBuffer (bandFrameBuffer (
+            source, levelWindow.min.x, levelWindow.min.y, m.sourceWidth));
+        tiled.readTiles (
+            0,
+            tiled.numXTiles (m.xLevel) - 1,
+            0,
+            tiled.numYTiles (m.yLevel) - 1,
+            m.xLevel,
+            m.yLevel);
+
+        steady_clock::time_point endRead = steady_clock::now ();
+        traceSpan ("read", "phase", startRead, endRead);
+        m.readTime = timing (startRead, endRead);
+    }
+    else
+    {
+        InputPart                scanline (in, part);
+        steady_clock::time_point startChunks = steady_clock::now ();
+        m.openTime = timing (start, startChunks);
+
+        int chunkLines = getCompressionNumScanlines (m.compression);
+        int numChunks  = (height + chunkLines - 1) / chunkLines;
+        m.chunkStep    = std::max (1, numChunks / m.height);
+        m.chunkCount   = (numChunks + m.chunkStep - 1) / m.chunkStep;
+
+        //
+        // with fewer chunks than preview lines, each keeps several lines
+        //
+        int chunkRows = std::min (
+            chunkLines, (m.height + m.chunkCount - 1) / m.chunkCount);
+
+        vector<BandPlane> chunk;
+        allocatePlanes (chunk, uint64_t (width) * chunkLines);
+        allocatePlanes (source, uint64_t (width) * m.chunkCount * chunkRows);
+        m.sourceWidth = width;
+
+        for (int c = 0; c < numChunks; c += m.chunkStep)
         {
-            throw runtime_error (
-                (inFileName + string (" contains unknown part type ") + type)
-                    .c_str ());
+            int y0    = dw.min.y + c * chunkLines;
+            int y1    = std::min (y0 + chunkLines - 1, dw.max.y);
+            int lines = y1 + 1 - y0;
+            int rows  = std::min (chunkRows, lines);
+
+            steady_clock::time_point startRead = steady_clock::now ();
+            scanline.setFrameBuffer (
+                bandFrameBuffer (chunk, dw.min.x, y0, width));
+            scanline.readPixels (y0, y1);
+            steady_clock::time_point endRead = steady_clock::now ();
+            m.readTime += timing (startRead, endRead);
+
+            int row = m.sourceHeight;
+            for (size_t p = 0; p < names.size (); ++p)
+            {
+                resamplePlane (
+                    reinterpret_cast<const float*> (chunk[p].data),
+                    width,
+                    lines,
+                    reinterpret_cast<float*> (source[p].data) +
+                        uint64_t (row) * width,
+                    width,
+                    rows,
+                    nullptr,
+                    BOX_FILTER,
+                    threadsFor (uint64_t (width) * lines));
+            }
+            m.sourceHeight += rows;
+            m.scaleTime += timing (endRead, steady_clock::now ());
         }
+        traceSpan ("read", "phase", startChunks, steady_clock::now ());
     }
-    struct stat instats, outstats;
-    stat (inFileName, &instats);
-    stat (outFileName, &outstats);
-    cout << "   \"input file size\": " << instats.st_size << ",\n";
-    cout << "   \"output file size\": " << outstats.st_size << "\n";
-    cout << "}\n";
+
+    steady_clock::time_point startScale = steady_clock::now ();
+    vector<BandPlane>        scaled;
+    allocatePlanes (scaled, uint64_t (m.width) * m.height);
+    float* scratch =
+        pool.allocate<float> (uint64_t (m.width) * m.sourceHeight);
+    for (size_t p = 0; p < names.size (); ++p)
+    {
+        resamplePlane (
+            reinterpret_cast<const float*> (source[p].data),
+            m.sourceWidth,
+            m.sourceHeight,
+            reinterpret_cast<float*> (scaled[p].data),
+            m.width,
+            m.height,
+            scratch,
+            BOX_FILTER,
+            threadsFor (uint64_t (m.sourceWidth) * m.sourceHeight));
+    }
+    steady_clock::time_point end = steady_clock::now ();
+    traceSpan ("scale", "phase", startScale, end);
+
+    m.scaleTime += timing (startScale, end);
+    m.totalTime = timing (start, end);
+    if (preview) { *preview = scaled; }
+    return m;
+}
+
+//
+// Preview the input part on its own, after decoding it whole to compare,
+// and write the preview as a half RGBA scanline part
+//
+void
+previewInput (
+    MultiPartInputFile& in,
+    const char          inFileName[],
+    int                 part,
+    const Header&       outHeader,
+    const char          outFileName[],
+    int                 size,
+    BufferPool&         pool,
+    Metrics&            metrics)
+{
+    FrameBuffer buf;
+    decodeFlatPart (
+        in, part, outHeader, "--preview", pool, buf, metrics.decode);
+
+    vector<BandPlane> planes;
+    metrics.preview = previewFile (inFileName, part, size, pool, &planes);
+
+    const PreviewMetrics& m         = metrics.preview;
+    uint64_t              numPixels = uint64_t (m.width) * m.height;
+
+    Header h (m.width, m.height);
+    h.compression () = outHeader.compression ();
+    for (BandPlane& p: planes)
+    {
+        uint16_t*    half  = pool.allocate<uint16_t> (numPixels);
+        const float* plane = reinterpret_cast<const float*> (p.data);
+        floatToHalf (plane, half, numPixels);
+        h.channels ().insert (p.name, Channel (HALF));
+        p.type       = HALF;
+        p.sampleSize = pixelTypeSize (HALF);
+        p.data       = reinterpret_cast<char*> (half);
+    }
+    writeLevelZero (outFileName, h, bandFrameBuffer (planes, 0, 0, m.width));
+}
+
+void
+sweepGeometries (
+    MultiPartInputFile&           in,
+    int                           part,
+    const Header&                 outHeader,
+    const char                    outFileName[],
+    const vector<OutputGeometry>& geometries,
+    int                           preview,
+    BufferPool&                   pool,
+    Metrics&                      metrics)
+{
+    FrameBuffer buf;
+    decodeFlatPart (
+        in,
+        part,
+        outHeader,
+        "changing output geometry",
+        pool,
+        buf,
+        metrics.decode);
+
+    for (const OutputGeometry& geometry: geometries)
+    {
+        Header h     = geometryHeader (outHeader, geometry);
+        bool   tiled = h.type () == TILEDIMAGE;
+
+        if (!tiled && h.lineOrder () == RANDOM_Y)
+        {
+            metrics.warnings.push_back (
+                "skipping random line order: not valid for scanline output");
+            continue;
+        }
+
+        double writeTime = writeLevelZero (outFileName, h, buf);
+        double readTime  = rereadLevelZero (outFileName, buf);
+
+        struct stat outstats;
+        stat (outFileName, &outstats);
+
+        GeometryMetrics g;
+        g.partType = h.type ();
+        if (tiled)
+        {
+            g.tileXSize = h.tileDescription ().xSize;
+            g.tileYSize = h.tileDescription ().ySize;
+        }
+        g.lineOrder      = h.lineOrder ();
+        g.chunkCount     = getChunkOffsetTableSize (h);
+        g.writeTime      = writeTime;
+        g.readTime       = readTime;
+        g.outputFileSize = outstats.st_size;
+        if (preview)
+        {
+            g.preview = previewFile (outFileName, 0, preview, pool, nullptr);
+        }
+        metrics.geometries.push_back (g);
+    }
+}
+
+//
+// Channel groups for the breakdown: every channel on its own, or channels
+// grouped by layer, the part of the name before the last '.'
+//
+vector<std::pair<string, vector<string>>>
+channelGroups (const Header& h, ChannelBreakdown breakdown)
+{
+    vector<std::pair<string, vector<string>>> groups;
+    for (ChannelList::ConstIterator i = h.channels ().begin ();
+         i != h.channels ().end ();
+         ++i)
+    {
+        string name = i.name ();
+        string group = name;
+        if (breakdown == PER_LAYER)
+        {
+            size_t dot = name.rfind ('.');
+            group      = dot == string::npos ? "" : name.substr (0, dot);
+        }
+
+        auto g = std::find_if (
+            groups.begin (),
+            groups.end (),
+            [&] (const std::pair<string, vector<string>>& x) {
+                return x.first == group;
+            });
+        if (g == groups.end ())
+        {
+            groups.push_back ({group, {}});
+            g = groups.end () - 1;
+        }
+        g->second.push_back (name);
+    }
+    return groups;
+}
+
+void
+channelBreakdown (
+    MultiPartInputFile& in,
+    int                 part,
+    const Header&       outHeader,
+    const char          outFileName[],
+    ChannelBreakdown    breakdown,
+    BufferPool&         pool,
+    Metrics&            metrics)
+{
+    FrameBuffer buf;
+    decodeFlatPart (
+        in,
+        part,
+        outHeader,
+        "per channel breakdown",
+        pool,
+        buf,
+        metrics.decode);
+
+    Box2i    dw        = outHeader.dataWindow ();
+    uint64_t numPixels = static_cast<uint64_t> (dw.max.x + 1 - dw.min.x) *
+                         (dw.max.y + 1 - dw.min.y);
+
+    //
+    // each group is written and read back on its own, as a part with just
+    // those channels
+    //
+    Header groupHeader = geometryHeader (outHeader, OutputGeometry ());
+
+    for (const auto& group: channelGroups (outHeader, breakdown))
+    {
+        ChannelList channels;
+        FrameBuffer groupBuf;
+        uint64_t    pixelSize = 0;
+        for (const string& name: group.second)
+        {
+            const Channel& channel = *outHeader.channels ().findChannel (name);
+            channels.insert (name, channel);
+            groupBuf.insert (name, *buf.findSlice (name.c_str ()));
+            pixelSize += pixelTypeSize (channel.type);
+        }
+        groupHeader.channels () = channels;
+
+        double writeTime = writeLevelZero (outFileName, groupHeader, groupBuf);
+        double readTime  = rereadLevelZero (outFileName, groupBuf);
+
+        struct stat outstats;
+        stat (outFileName, &outstats);
+
+        ChannelGroupMetrics g;
+        g.name           = group.first;
+        g.channels       = group.second;
+        g.writeTime      = writeTime;
+        g.readTime       = readTime;
+        g.rawSize        = numPixels * pixelSize;
+        g.outputFileSize = outstats.st_size;
+        metrics.channelGroups.push_back (g);
+    }
+}
+
+//
+// Decode level 0 in the input's own channel types, convert to the output
+// types in a separate, timed stage, then encode. For comparison, the input
+// is decoded again straight into the output types, leaving the conversion
+// to the library.
+//
+void
+explicitHalfCopy (
+    MultiPartInputFile& in,
+    int                 part,
+    const Header&       outHeader,
+    const char          outFileName[],
+    BufferPool&         pool,
+    Metrics&            metrics)
+{
+    const Header& inHeader = in.header (part);
+    if (inHeader.type () != SCANLINEIMAGE && inHeader.type () != TILEDIMAGE)
+    {
+        throw runtime_error (
+            "--explicit-half is only supported for scanline and tiled parts");
+    }
+
+    Box2i    dw        = outHeader.dataWindow ();
+    uint64_t width     = dw.max.x + 1 - dw.min.x;
+    uint64_t height    = dw.max.y + 1 - dw.min.y;
+    uint64_t numPixels = width * height;
+    uint64_t offsetToOrigin = width * static_cast<uint64_t> (dw.min.y) +
+                              static_cast<uint64_t> (dw.min.x);
+
+    FrameBuffer sourceBuf;
+    allocateFrameBuffer (pool, inHeader, dw, sourceBuf);
+    FrameBuffer libraryBuf;
+    allocateFrameBuffer (pool, outHeader, dw, libraryBuf);
+
+    //
+    // decoding in the input's types is compared with the library decoding
+    // to half: after one untimed read, so that neither finds the file or
+    // its buffer colder, each runs twice in alternating order, and the
+    // faster run counts
+    //
+    readLevelZero (in, part, libraryBuf);
+
+    double readTime        = INFINITY;
+    double libraryReadTime = INFINITY;
+    for (int run = 0; run < 4; ++run)
+    {
+        bool library = run == 1 || run == 2;
+
+        steady_clock::time_point start = steady_clock::now ();
+        readLevelZero (in, part, library ? libraryBuf : sourceBuf);
+        steady_clock::time_point end = steady_clock::now ();
+        traceSpan (library ? "library read" : "read", "phase", start, end);
+
+        double& best = library ? libraryReadTime : readTime;
+        best         = std::min (best, timing (start, end));
+    }
+
+    //
+    // channels that keep their type are written from the decoded buffer
+    //
+    struct Conversion
+    {
+        PixelType   from;
+        const char* in;
+        uint16_t*   out;
+    };
+
+    vector<Conversion> conversions;
+    FrameBuffer        outBuf;
+    int                pixelSize = 0;
+
+    for (ChannelList::ConstIterator i = outHeader.channels ().begin ();
+         i != outHeader.channels ().end ();
+         ++i)
+    {
+        const Slice& source = *sourceBuf.findSlice (i.name ());
+        int          size   = pixelTypeSize (i.channel ().type);
+        pixelSize += size;
+
+        if (source.type == i.channel ().type)
+        {
+            outBuf.insert (i.name (), source);
+            continue;
+        }
+
+        if (i.channel ().type != HALF)
+        {
+            throw runtime_error ("--explicit-half only converts to half");
+        }
+
+        char* base = pool.allocate (numPixels * size);
+        outBuf.insert (
+            i.name (),
+            Slice (HALF, base - offsetToOrigin * size, size, size * width));
+        conversions.push_back (
+            {source.type,
+             source.base + offsetToOrigin * pixelTypeSize (source.type),
+             reinterpret_cast<uint16_t*> (base)});
+    }
+
+    //
+    // one pass over the pool, each block converting every channel, so the
+    // stage pays for handing out work once rather than once a channel
+    //
+    steady_clock::time_point startConvert = steady_clock::now ();
+    forBlocks (numPixels, [&] (uint64_t first, uint64_t count) {
+        for (const Conversion& c: conversions)
+        {
+            if (c.from == FLOAT)
+            {
+                floatToHalf (
+                    reinterpret_cast<const float*> (c.in) + first,
+                    c.out + first,
+                    count);
+            }
+            else
+            {
+                uintToHalf (
+                    reinterpret_cast<const uint32_t*> (c.in) + first,
+                    c.out + first,
+                    count);
+            }
+        }
+    });
+    steady_clock::time_point endConvert = steady_clock::now ();
+    traceSpan ("convert", "phase", startConvert, endConvert);
+
+    Header h         = geometryHeader (outHeader, OutputGeometry ());
+    double writeTime = writeLevelZero (outFileName, h, outBuf);
+
+    struct stat outstats;
+    stat (outFileName, &outstats);
+
+    metrics.decode.readTime   = readTime;
+    metrics.decode.pixelCount = numPixels;
+    metrics.decode.rawSize    = numPixels * pixelSize;
+
+    ExplicitHalfMetrics& half = metrics.explicitHalf;
+    half.convertTime          = timing (startConvert, endConvert);
+    half.convertPath          = halfConvertPath ();
+    half.convertedChannels    = static_cast<int> (conversions.size ());
+    half.writeTime            = writeTime;
+    half.outputFileSize       = outstats.st_size;
+    half.libraryReadTime      = libraryReadTime;
+}
+
+//
+// Levels tried for the codecs that take one; infinity stands for none
+//
+vector<float>
+codecLevels (Compression compression)
+{
+    switch (compression)
+    {
+        case ZIP_COMPRESSION:
+        case ZIPS_COMPRESSION: return {1, 4, 6, 9};
+        case DWAA_COMPRESSION:
+        case DWAB_COMPRESSION: return {15, 45, 90, 180};
+        default: return {INFINITY};
+    }
+}
+
+void
+setCodec (Header& h, Compression compression, float level)
+{
+    h.compression () = compression;
+    if (isinf (level)) { return; }
+    if (compression == ZIP_COMPRESSION || compression == ZIPS_COMPRESSION)
+    {
+        h.zipCompressionLevel () = static_cast<int> (level);
+    }
+    else { h.dwaCompressionLevel () = level; }
+}
+
+//
+// First byte of level 0 of a channel's buffer
+//
+char*
+planeOrigin (const Slice& slice, const Box2i& dw)
+{
+    uint64_t width          = dw.max.x + 1 - dw.min.x;
+    uint64_t offsetToOrigin = width * static_cast<uint64_t> (dw.min.y) +
+                              static_cast<uint64_t> (dw.min.x);
+    return slice.base + offsetToOrigin * slice.xStride;
+}
+
+//
+// Trial encode and decode evenly spaced bands of the part in memory with
+// every codec and level, predict the whole part from them, pick the codec
+// that best meets the objective and write the output with it
+//
+void
+autoCodecCopy (
+    MultiPartInputFile& in,
+    int                 part,
+    const Header&       outHeader,
+    const char          outFileName[],
+    const AutoCodec&    objective,
+    BufferPool&         pool,
+    Metrics&            metrics)
+{
+    FrameBuffer buf;
+    decodeFlatPart (in, part, outHeader, "--auto", pool, buf, metrics.decode);
+
+    AutoCodecMetrics&        result      = metrics.autoCodec;
+    steady_clock::time_point startSelect = steady_clock::now ();
+
+    Header h      = geometryHeader (outHeader, OutputGeometry ());
+    Box2i  dw     = h.dataWindow ();
+    int    width  = dw.max.x + 1 - dw.min.x;
+    int    height = dw.max.y + 1 - dw.min.y;
+
+    //
+    // bands hold whole chunks for every codec: 256 lines, the most any
+    // codec puts in a chunk, rounded up to whole tiles
+    //
+    int bandHeight = 256;
+    if (h.hasTileDescription ())
+    {
+        int tileHeight = h.tileDescription ().ySize;
+        bandHeight = (bandHeight + tileHeight - 1) / tileHeight * tileHeight;
+    }
+    int bands       = (height + bandHeight - 1) / bandHeight;
+    int sampleBands =
+        static_cast<int> (lround (objective.sampleFraction * bands));
+    sampleBands = std::min (bands, std::max (1, sampleBands));
+
+    //
+    // in increasing order, so a short last band can only come last
+    //
+    vector<int> sample;
+    int         sampleHeight = 0;
+    for (int k = 0; k < sampleBands; ++k)
+    {
+        int band = static_cast<int> ((k + 0.5) * bands / sampleBands);
+        sample.push_back (band);
+        sampleHeight += std::min (bandHeight, height - band * bandHeight);
+    }
+
+    Box2i sampleDw (
+        dw.min, Imath::V2i (dw.max.x, dw.min.y + sampleHeight - 1));
+    Header sampleHeader           = h;
+    sampleHeader.dataWindow ()    = sampleDw;
+    sampleHeader.displayWindow () = sampleDw;
+
+    FrameBuffer sampleBuf, scratchBuf;
+    allocateFrameBuffer (pool, sampleHeader, sampleDw, sampleBuf);
+    allocateFrameBuffer (pool, sampleHeader, sampleDw, scratchBuf);
+
+    for (ChannelList::ConstIterator i = h.channels ().begin ();
+         i != h.channels ().end ();
+         ++i)
+    {
+        uint64_t rowSize = uint64_t (width) * pixelTypeSize (i.channel ().type);
+        const char* from = planeOrigin (*buf.findSlice (i.name ()), dw);
+        char* to = planeOrigin (*sampleBuf.findSlice (i.name ()), sampleDw);
+        for (int band: sample)
+        {
+            uint64_t first = uint64_t (band) * bandHeight;
+            int      rows  = std::min (bandHeight, height - int (first));
+            memcpy (to, from + first * rowSize, rows * rowSize);
+            to += rows * rowSize;
+        }
+    }
+
+    uint64_t budget =
+        objective.sizeBudget
+            ? objective.sizeBudget
+            : uint64_t (objective.sizeFraction * metrics.decode.rawSize);
+    double scale = double (height) / sampleHeight;
+
+    for (int c = 0; c < NUM_COMPRESSION_METHODS; ++c)
+    {
+        Compression compression = static_cast<Compression> (c);
+        if (objective.lossless && isLossyCompression (compression)) continue;
+
+        for (float level: codecLevels (compression))
+        {
+            Header trial = sampleHeader;
+            setCodec (trial, compression, level);
+
+            CandidateMetrics candidate;
+            candidate.compression = compression;
+            candidate.level       = level;
+
+            MemoryOStream encoded;
+            {
+                MultiPartOutputFile out (encoded, &trial, 1);
+                candidate.sampleEncodeTime = writeLevelZero (out, sampleBuf);
+            }
+            MemoryIStream      decoded (encoded.data ());
+            MultiPartInputFile reread (decoded);
+            candidate.sampleDecodeTime = rereadLevelZero (reread, scratchBuf);
+            candidate.sampleSize       = encoded.data ().size ();
+
+            candidate.predictedSize = uint64_t (candidate.sampleSize * scale);
+            candidate.predictedEncodeTime = candidate.sampleEncodeTime * scale;
+            candidate.predictedDecodeTime = candidate.sampleDecodeTime * scale;
+
+            if (objective.objective == AutoCodec::FASTEST_DECODE)
+            {
+                candidate.feasible = candidate.predictedSize <= budget;
+            }
+            else
+            {
+                candidate.feasible =
+                    objective.minEncodeFps <= 0 ||
+                    candidate.predictedEncodeTime * objective.minEncodeFps <= 1;
+            }
+            result.candidates.push_back (candidate);
+        }
+    }
+
+    //
+    // the best feasible candidate; if there is none, the one closest to
+    // meeting the constraint
+    //
+    auto cost = [&] (const CandidateMetrics& m) {
+        if (objective.objective == AutoCodec::FASTEST_DECODE)
+        {
+            return m.feasible ? m.predictedDecodeTime
+                              : double (m.predictedSize);
+        }
+        return m.feasible ? double (m.predictedSize) : m.predictedEncodeTime;
+    };
+
+    bool anyFeasible = false;
+    for (const CandidateMetrics& m: result.candidates)
+    {
+        anyFeasible = anyFeasible || m.feasible;
+    }
+    if (!anyFeasible)
+    {
+        metrics.warnings.push_back (
+            "no codec meets the --auto constraint: picking the closest");
+    }
+
+    for (size_t c = 0; c < result.candidates.size (); ++c)
+    {
+        const CandidateMetrics& m = result.candidates[c];
+        if (m.feasible != anyFeasible) continue;
+        if (result.chosen < 0 ||
+            cost (m) < cost (result.candidates[result.chosen]))
+        {
+            result.chosen = static_cast<int> (c);
+        }
+    }
+
+    result.bandHeight    = bandHeight;
+    result.bands         = bands;
+    result.sampleBands   = sampleBands;
+    result.sizeBudget    = budget;
+    result.selectionTime = timing (startSelect, steady_clock::now ());
+
+    const CandidateMetrics& chosen = result.candidates[result.chosen];
+    setCodec (h, chosen.compression, chosen.level);
+    result.writeTime = writeLevelZero (outFileName, h, buf);
+    result.readTime  = rereadLevelZero (outFileName, buf);
+
+    struct stat outstats;
+    stat (outFileName, &outstats);
+    result.outputFileSize = outstats.st_size;
+}
+
+//
+// Write a whole level of a tiled part from buf, returning the time taken
+//
+double
+writeLevel (
+    TiledOutputPart& out, int xLevel, int yLevel, const FrameBuffer& buf)
+{
+    out.setFrameBuffer (buf);
+    steady_clock::time_point startWrite = steady_clock::now ();
+    out.writeTiles (
+        0,
+        out.numXTiles (xLevel) - 1,
+        0,
+        out.numYTiles (yLevel) - 1,
+        xLevel,
+        yLevel);
+    steady_clock::time_point endWrite = steady_clock::now ();
+    traceSpan ("write", "phase", startWrite, endWrite);
+    return timing (startWrite, endWrite);
+}
+
+//
+// Decode level 0 of the part and write it as a mipmapped or ripmapped
+// tiled part, building each level from the one before it: a mip level
+// from the previous one, a rip level from its left neighbour, or from the
+// one above for the first of a row, as the levels are stored. HALF
+// channels are filtered as float and converted back for writing; FLOAT
+// channels are filtered as they are; UINT channels are point sampled.
+//
+void
+mipLevelsCopy (
+    MultiPartInputFile& in,
+    int                 part,
+    const Header&       outHeader,
+    const char          outFileName[],
+    const MipLevels&    mip,
+    int                 preview,
+    BufferPool&         pool,
+    Metrics&            metrics)
+{
+    FrameBuffer levelZero;
+    decodeFlatPart (
+        in, part, outHeader, "--mip", pool, levelZero, metrics.decode);
+
+    Header h = outHeader;
+    h.setTileDescription (TileDescription (
+        mip.tileXSize, mip.tileYSize, mip.mode, mip.rounding));
+    h.setType (TILEDIMAGE);
+
+    //
+    // levels are written whole, top to bottom, which the library would
+    // otherwise hold back for a decreasing file
+    //
+    h.lineOrder () = INCREASING_Y;
+
+    Box2i    dw         = h.dataWindow ();
+    uint64_t numPixels  = metrics.decode.pixelCount;
+    int      numThreads = std::max (1, globalThreadCount ());
+
+    MipMetrics& result = metrics.mipLevels;
+    result.filterPath  = mipFilterPath ();
+    result.convertPath = halfConvertPath ();
+    result.threads     = numThreads;
+
+    //
+    // level 0 as filter input: HALF widened to float, the rest in place
+    //
+    vector<BandPlane> channels;
+    vector<char*>     sourcePlanes;
+    for (ChannelList::ConstIterator i = h.channels ().begin ();
+         i != h.channels ().end ();
+         ++i)
+    {
+        PixelType type   = i.channel ().type;
+        char*     origin = planeOrigin (*levelZero.findSlice (i.name ()), dw);
+        channels.push_back ({i.name (), type, pixelTypeSize (type), nullptr});
+        if (type != HALF)
+        {
+            sourcePlanes.push_back (origin);
+            continue;
+        }
+
+        float* plane = pool.allocate<float> (numPixels);
+        steady_clock::time_point startConvert = steady_clock::now ();
+        forBlocks (numPixels, [&] (uint64_t first, uint64_t count) {
+            halfToFloat (
+                reinterpret_cast<const uint16_t*> (origin) + first,
+                plane + first,
+                count);
+        });
+        steady_clock::time_point endConvert = steady_clock::now ();
+        traceSpan ("to float", "phase", startConvert, endConvert);
+        result.toFloatTime += timing (startConvert, endConvert);
+        sourcePlanes.push_back (reinterpret_cast<char*> (plane));
+    }
+
+    {
+        MultiPartOutputFile file (outFileName, &h, 1);
+        TiledOutputPart     out (file, 0);
+
+        //
+        // the levels in the order the file stores them
+        //
+        vector<std::pair<int, int>> order;
+        if (mip.mode == RIPMAP_LEVELS)
+        {
+            for (int yLevel = 0; yLevel < out.numYLevels (); ++yLevel)
+            {
+                for (int xLevel = 0; xLevel < out.numXLevels (); ++xLevel)
+                {
+                    order.emplace_back (xLevel, yLevel);
+                }
+            }
+        }
+        else
+        {
+            for (int level = 0; level < out.numLevels (); ++level)
+            {
+                order.emplace_back (level, level);
+            }
+        }
+
+        //
+        // float planes of every level, filter input for the ones after;
+        // scratch holds the widest level's horizontal pass over the
+        // tallest
+        //
+        vector<vector<char*>> planes (order.size ());
+        planes[0]      = sourcePlanes;
+        float* scratch = pool.allocate<float> (numPixels);
+
+        for (size_t l = 0; l < order.size (); ++l)
+        {
+            int xLevel = order[l].first;
+            int yLevel = order[l].second;
+
+            MipLevelMetrics level;
+            level.xLevel    = xLevel;
+            level.yLevel    = yLevel;
+            level.width     = out.levelWidth (xLevel);
+            level.height    = out.levelHeight (yLevel);
+            level.tileCount = out.numXTiles (xLevel) * out.numYTiles (yLevel);
+
+            if (l == 0)
+            {
+                level.writeTime = writeLevel (out, 0, 0, levelZero);
+                result.levels.push_back (level);
+                continue;
+            }
+
+            size_t source = mip.mode == RIPMAP_LEVELS && xLevel == 0
+                                ? l - out.numXLevels ()
+                                : l - 1;
+            int srcWidth  = out.levelWidth (order[source].first);
+            int srcHeight = out.levelHeight (order[source].second);
+            uint64_t levelPixels = uint64_t (level.width) * level.height;
+
+            steady_clock::time_point startFilter = steady_clock::now ();
+            for (size_t c = 0; c < channels.size (); ++c)
+            {
+                char* plane = pool.allocate (levelPixels * sizeof (float));
+                if (channels[c].type == UINT)
+                {
+                    pointSamplePlane (
+                        reinterpret_cast<const uint32_t*> (planes[source][c]),
+                        srcWidth,
+                        srcHeight,
+                        reinterpret_cast<uint32_t*> (plane),
+                        level.width,
+                        level.height);
+                }
+                else
+                {
+                    resamplePlane (
+                        reinterpret_cast<const float*> (planes[source][c]),
+                        srcWidth,
+                        srcHeight,
+                        reinterpret_cast<float*> (plane),
+                        level.width,
+                        level.height,
+                        scratch,
+                        mip.filter,
+                        numThreads);
+                }
+                planes[l].push_back (plane);
+            }
+            steady_clock::time_point endFilter = steady_clock::now ();
+            traceSpan ("filter", "phase", startFilter, endFilter);
+
+            //
+            // HALF channels are narrowed into their own buffers
+            //
+            steady_clock::time_point startConvert = steady_clock::now ();
+            for (size_t c = 0; c < channels.size (); ++c)
+            {
+                channels[c].data = planes[l][c];
+                if (channels[c].type != HALF) { continue; }
+
+                uint16_t* half = pool.allocate<uint16_t> (levelPixels);
+                const float* plane =
+                    reinterpret_cast<const float*> (planes[l][c]);
+                forBlocks (levelPixels, [&] (uint64_t first, uint64_t count) {
+                    floatToHalf (plane + first, half + first, count);
+                });
+                channels[c].data = reinterpret_cast<char*> (half);
+            }
+            steady_clock::time_point endConvert = steady_clock::now ();
+            traceSpan ("convert", "phase", startConvert, endConvert);
+
+            FrameBuffer buf =
+                bandFrameBuffer (channels, dw.min.x, dw.min.y, level.width);
+            level.filterTime  = timing (startFilter, endFilter);
+            level.convertTime = timing (startConvert, endConvert);
+            level.writeTime   = writeLevel (out, xLevel, yLevel, buf);
+            result.levels.push_back (level);
+        }
+    }
+
+    for (const MipLevelMetrics& level: result.levels)
+    {
+        result.filterTime += level.filterTime;
+        result.convertTime += level.convertTime;
+        result.writeTime += level.writeTime;
+    }
+
+    struct stat outstats;
+    stat (outFileName, &outstats);
+    result.outputFileSize = outstats.st_size;
+
+    if (preview)
+    {
+        result.preview = previewFile (outFileName, 0, preview, pool, nullptr);
+    }
+}
+
+//
+// Read level 0 of fileName twice: once with every channel in the frame
+// buffer and once with only the channels matching one of the patterns
+//
+void
+subsetRead (
+    const char            fileName[],
+    const vector<string>& patterns,
+    BufferPool&           pool,
+    SubsetReadMetrics&    metrics)
+{
+    MultiPartInputFile file (fileName);
+    const Header&      h = file.header (0);
+
+    if (h.type () != SCANLINEIMAGE && h.type () != TILEDIMAGE)
+    {
+        throw runtime_error (
+            "--read-channels is only supported for scanline and tiled parts");
+    }
+
+    FrameBuffer fullBuf;
+    int fullSize = allocateFrameBuffer (pool, h, h.dataWindow (), fullBuf);
+
+    FrameBuffer    subsetBuf;
+    vector<string> names;
+    int            subsetSize = 0;
+    for (ChannelList::ConstIterator i = h.channels ().begin ();
+         i != h.channels ().end ();
+         ++i)
+    {
+        for (const string& pattern: patterns)
+        {
+            if (fnmatch (pattern.c_str (), i.name (), 0) == 0)
+            {
+                subsetBuf.insert (i.name (), *fullBuf.findSlice (i.name ()));
+                names.push_back (i.name ());
+                subsetSize += pixelTypeSize (i.channel ().type);
+                break;
+            }
+        }
+    }
+
+    if (names.empty ())
+    {
+        throw runtime_error ("no channels match --read-channels");
+    }
+
+    steady_clock::time_point startFull = steady_clock::now ();
+    readLevelZero (file, 0, fullBuf);
+    steady_clock::time_point endFull = steady_clock::now ();
+    traceSpan ("full read", "phase", startFull, endFull);
+
+    steady_clock::time_point startSubset = steady_clock::now ();
+    readLevelZero (file, 0, subsetBuf);
+    steady_clock::time_point endSubset = steady_clock::now ();
+    traceSpan ("subset read", "phase", startSubset, endSubset);
+
+    metrics.channels       = names;
+    metrics.fullReadTime   = timing (startFull, endFull);
+    metrics.subsetReadTime = timing (startSubset, endSubset);
+    metrics.rawFraction    = double (subsetSize) / fullSize;
+}
+
+//
+// Copy one pass of part to the single part of out with the Imf classes,
+// the whole frame at once, or band chunks or tile rows at a time if band
+// is positive
+//
+void
+copyPart (
+    const char           inFileName[],
+    MultiPartInputFile&  in,
+    int                  part,
+    MultiPartOutputFile& out,
+    int                  band,
+    const Settings&      settings,
+    BufferPool&          pool,
+    CopyMetrics&         metrics)
+{
+    string type = out.header (0).type ();
+
+    if (band > 0 && type != TILEDIMAGE && type != SCANLINEIMAGE)
+    {
+        throw runtime_error (
+            "--band is only supported for scanline and tiled parts");
+    }
+
+    if (type == TILEDIMAGE)
+    {
+        TiledInputPart  inpart (in, part);
+        TiledOutputPart outpart (out, 0);
+        if (band > 0)
+        {
+            copyTiledBanded (inpart, outpart, band, pool, metrics);
+        }
+        else { copyTiled (inpart, outpart, pool, metrics); }
+    }
+    else if (type == SCANLINEIMAGE)
+    {
+        InputPart  inpart (in, part);
+        OutputPart outpart (out, 0);
+        if (band > 0)
+        {
+            copyScanLineBanded (inpart, outpart, band, pool, metrics);
+        }
+        else { copyScanLine (inpart, outpart, pool, metrics); }
+    }
+    else if (type == DEEPSCANLINE)
+    {
+        DeepScanLineInputPart  inpart (in, part);
+        DeepScanLineOutputPart outpart (out, 0);
+        copyDeepScanLine (inpart, outpart, settings, pool, metrics);
+    }
+    else if (type == DEEPTILE)
+    {
+        DeepTiledInputPart  inpart (in, part);
+        DeepTiledOutputPart outpart (out, 0);
+        copyDeepTiled (inpart, outpart, settings, pool, metrics);
+    }
+    else
+    {
+        throw runtime_error (
+            (inFileName + string (" contains unknown part type ") + type)
+                .c_str ());
+    }
+}
+
+const char*
+poolName (const BufferPool& pool)
+{
+    if (!pool.reuse ()) { return "none"; }
+    switch (pool.hugePages ())
+    {
+        case TRANSPARENT_HUGE_PAGES: return "reuse, transparent huge pages";
+        case EXPLICIT_HUGE_PAGES: return "reuse, explicit huge pages";
+        default: return "reuse";
+    }
+}
+
+//
+// pool times so far, for the whole run or one pass
+//
+void
+takePoolTimes (BufferPool& pool, CopyMetrics& metrics)
+{
+    metrics.allocTime      = pool.allocTime ();
+    metrics.firstTouchTime = pool.firstTouchTime ();
+}
+
+CopyMetrics
+decodeFile (const char fileName[], int part, BufferPool& pool)
+{
+    MultiPartInputFile in (fileName);
+    if (part >= in.parts ())
+    {
+        throw runtime_error (
+            string (fileName) + " only contains " + to_string (in.parts ()) +
+            " parts. Cannot decode part " + to_string (part));
+    }
+
+    FrameBuffer buf;
+    CopyMetrics decode;
+    decodeFlatPart (in, part, in.header (part), "--load", pool, buf, decode);
+    return decode;
+}
+
+bool
+isPlainCopy (const Settings& settings)
+{
+    return settings.geometries.empty () &&
+           settings.breakdown == NO_BREAKDOWN && !settings.explicitHalf &&
+           settings.autoCodec.objective == AutoCodec::OFF &&
+           settings.mipLevels.mode == ONE_LEVEL && settings.preview == 0;
+}
+
+Metrics
+exrmetrics (
+    const char      inFileName[],
+    const char      outFileName[],
+    const Settings& settings,
+    BufferPool&     pool)
+{
+    Metrics metrics;
+    metrics.settings = settings;
+
+    int part = settings.part;
+
+    MultiPartInputFile in (inFileName);
+    if (part >= in.parts ())
+    {
+        throw runtime_error ((string (inFileName) + " only contains " +
+                              to_string (in.parts ()) +
+                              " parts. Cannot copy part " + to_string (part))
+                                 .c_str ());
+    }
+    Header outHeader = in.header (part);
+
+    Compression compression = settings.compression;
+    if (compression < NUM_COMPRESSION_METHODS)
+    {
+        outHeader.compression () = compression;
+    }
+    else { compression = outHeader.compression (); }
+
+    float level = settings.level;
+    if (!isinf (level) && level >= -1)
+    {
+        switch (outHeader.compression ())
+        {
+            case DWAA_COMPRESSION:
+            case DWAB_COMPRESSION:
+                outHeader.dwaCompressionLevel () = level;
+                break;
+            case ZIP_COMPRESSION:
+            case ZIPS_COMPRESSION:
+                outHeader.zipCompressionLevel () = level;
+                break;
+                //            case ZSTD_COMPRESSION :
+                //                outHeader.zstdCompressionLevel()=level;
+                //                break;
+            default:
+                throw runtime_error (
+                    "-l option only works for DWAA/DWAB,ZIP/ZIPS or ZSTD compression");
+        }
+    }
+
+    int halfMode = settings.halfMode;
+    if (halfMode > 0)
+    {
+        for (ChannelList::Iterator i = outHeader.channels ().begin ();
+             i != outHeader.channels ().end ();
+             ++i)
+        {
+            if (halfMode == 2 || !strcmp (i.name (), "R") ||
+                !strcmp (i.name (), "G") || !strcmp (i.name (), "B") ||
+                !strcmp (i.name (), "A"))
+            {
+                i.channel ().type = HALF;
+            }
+        }
+    }
+
+    metrics.inputCompression    = in.header (part).compression ();
+    metrics.outputCompression   = outHeader.compression ();
+    metrics.zipCompressionLevel = outHeader.zipCompressionLevel ();
+    metrics.dwaCompressionLevel = outHeader.dwaCompressionLevel ();
+    metrics.partType            = outHeader.type ();
+    if (metrics.partType == SCANLINEIMAGE)
+    {
+        metrics.scanlinesPerChunk = getCompressionNumScanlines (compression);
+    }
+    metrics.bufferPool = poolName (pool);
+
+    struct stat instats, outstats;
+
+    if (settings.explicitHalf && halfMode == 0)
+    {
+        throw runtime_error ("--explicit-half requires the -16 option");
+    }
+
+    //
+    // --preview adds to a geometry sweep or --mip, or is a mode of its own
+    //
+    bool previewOnly = settings.preview > 0 && settings.geometries.empty () &&
+                       settings.mipLevels.mode == ONE_LEVEL;
+
+    int modes = !settings.geometries.empty () +
+                (settings.breakdown != NO_BREAKDOWN) + settings.explicitHalf +
+                (settings.autoCodec.objective != AutoCodec::OFF) +
+                (settings.mipLevels.mode != ONE_LEVEL) + previewOnly;
+    if (modes > 0)
+    {
+        if (settings.engine & CORE_ENGINE)
+        {
+            throw runtime_error ("the core engine only supports a plain copy");
+        }
+        if (!settings.bands.empty ())
+        {
+            throw runtime_error ("--band only applies to a plain copy");
+        }
+        if (settings.flatten)
+        {
+            throw runtime_error ("--flatten only applies to a plain copy");
+        }
+        if (modes > 1)
+        {
+            throw runtime_error (
+                "changing output geometry, per channel breakdown, "
+                "--explicit-half, --auto and --mip cannot be combined, and "
+                "--preview only with the first and last");
+        }
+        if (settings.passes > 1)
+        {
+            metrics.warnings.push_back (
+                "ignoring --passes: it only applies to a plain copy");
+        }
+        if (!settings.readChannels.empty ())
+        {
+            metrics.warnings.push_back (
+                "ignoring --read-channels: it only applies to a plain copy");
+        }
+
+        stat (inFileName, &instats);
+        metrics.inputFileSize = instats.st_size;
+        pool.resetTimes ();
+        if (settings.breakdown != NO_BREAKDOWN)
+        {
+            TraceSpan span ("channel breakdown", "mode");
+            channelBreakdown (
+                in,
+                part,
+                outHeader,
+                outFileName,
+                settings.breakdown,
+                pool,
+                metrics);
+        }
+        else if (settings.autoCodec.objective != AutoCodec::OFF)
+        {
+            TraceSpan span ("auto codec", "mode");
+            autoCodecCopy (
+                in,
+                part,
+                outHeader,
+                outFileName,
+                settings.autoCodec,
+                pool,
+                metrics);
+        }
+        else if (settings.mipLevels.mode != ONE_LEVEL)
+        {
+            TraceSpan span ("mip levels", "mode");
+            mipLevelsCopy (
+                in,
+                part,
+                outHeader,
+                outFileName,
+                settings.mipLevels,
+                settings.preview,
+                pool,
+                metrics);
+        }
+        else if (settings.explicitHalf)
+        {
+            TraceSpan span ("explicit half", "mode");
+            explicitHalfCopy (in, part, outHeader, outFileName, pool, metrics);
+        }
+        else if (previewOnly)
+        {
+            TraceSpan span ("preview", "mode");
+            previewInput (
+                in,
+                inFileName,
+                part,
+                outHeader,
+                outFileName,
+                settings.preview,
+                pool,
+                metrics);
+        }
+        else
+        {
+            TraceSpan span ("geometry sweep", "mode");
+            sweepGeometries (
+                in,
+                part,
+                outHeader,
+                outFileName,
+                settings.geometries,
+                settings.preview,
+                pool,
+                metrics);
+        }
+        takePoolTimes (pool, metrics.decode);
+        pool.release ();
+        return metrics;
+    }
+
+    if (!(settings.engine & IMF_ENGINE) && !settings.bands.empty ())
+    {
+        metrics.warnings.push_back (
+            "ignoring --band: it only applies to the imf engine");
+    }
+    if (settings.flatten &&
+        (!(settings.engine & IMF_ENGINE) ||
+         (metrics.partType != DEEPSCANLINE && metrics.partType != DEEPTILE)))
+    {
+        metrics.warnings.push_back (
+            "ignoring --flatten: it only applies to deep parts with the imf "
+            "engine");
+    }
+
+    //
+    // checked before copying, rather than failing to read back a device
+    // such as /dev/null once the copy is done
+    //
+    if (!settings.readChannels.empty () && stat (outFileName, &outstats) == 0 &&
+        !S_ISREG (outstats.st_mode))
+    {
+        throw runtime_error (
+            string ("--read-channels reads the output back, so it needs an "
+                    "output file, not ") +
+            outFileName);
+    }
+
+    if (settings.engine & IMF_ENGINE)
+    {
+        //
+        // without --band, each pass copies the whole frame once
+        //
+        vector<int> bands = settings.bands;
+        if (bands.empty ()) { bands.push_back (0); }
+
+        for (int pass = 0; pass < settings.passes; ++pass)
+        {
+            for (int band: bands)
+            {
+                int index = static_cast<int> (metrics.passes.size ());
+                metrics.passes.push_back (CopyMetrics ());
+
+                pool.resetTimes ();
+                {
+                    TraceSpan span ("imf copy", "pass", "pass", index);
+                    MultiPartOutputFile out (outFileName, &outHeader, 1);
+                    copyPart (
+                        inFileName,
+                        in,
+                        part,
+                        out,
+                        band,
+                        settings,
+                        pool,
+                        metrics.passes.back ());
+                }
+                takePoolTimes (pool, metrics.passes.back ());
+                pool.release ();
+            }
+        }
+
+        if (pool.reuse ()) { metrics.poolSize = pool.size (); }
+
+        //
+        // before a core copy replaces the file
+        //
+        stat (outFileName, &outstats);
+        metrics.outputFileSize = outstats.st_size;
+    }
+
+    if (settings.engine & CORE_ENGINE)
+    {
+        TraceSpan span ("core copy", "pass");
+        pool.resetTimes ();
+        metrics.core = copyCore (
+            inFileName,
+            part,
+            outFileName,
+            outHeader,
+            pool,
+            globalThreadCount ());
+        metrics.core.allocTime      = pool.allocTime ();
+        metrics.core.firstTouchTime = pool.firstTouchTime ();
+        pool.release ();
+
+        stat (outFileName, &outstats);
+        metrics.core.outputFileSize = outstats.st_size;
+        if (!(settings.engine & IMF_ENGINE))
+        {
+            metrics.outputFileSize = outstats.st_size;
+        }
+    }
+
+    if (!settings.readChannels.empty ())
+    {
+        TraceSpan span ("subset read", "mode");
+        subsetRead (
+            outFileName, settings.readChannels, pool, metrics.subsetRead);
+        pool.release ();
+    }
+
+    stat (inFileName, &instats);
+    metrics.inputFileSize = instats.st_size;
+    return metrics;
 }
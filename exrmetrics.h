@@ -4,11 +4,18 @@
 
 //----------------------------------------------------------------------------
 //
-//	Copy input to output, reporting file size and timing
+//	Copy input to output, measuring file size and timing
 //
 //----------------------------------------------------------------------------
 
 #include "ImfCompression.h"
+#include "ImfLineOrder.h"
+#include "ImfTileDescription.h"
+
+#include <cstdint>
+#include <math.h>
+#include <string>
+#include <vector>
 
 // Backport from 3.3.1
 #if OPENEXR_VERSION_MINOR < 3
@@ -28,13 +35,372 @@ getCompressionIdFromName (const std::string& name, Imf::Compression& id);
 IMF_EXPORT void
 getCompressionNamesString (const std::string& separator, std::string& in);
 
+/// Return true if a compression id is a lossy algorithm, false otherwise.
+IMF_EXPORT bool isLossyCompression (Imf::Compression id);
+
 #endif
 
-void exrmetrics (
-    const char       inFileName[],
-    const char       outFileName[],
-    int              part,
-    Imf::Compression compression,
-    float            level,
-    int              halfMode);
+class BufferPool;
+
+/// Chunk layout to write the output part with.
+struct OutputGeometry
+{
+    enum Layout
+    {
+        RETAIN,   // same layout and tile size as the input part
+        SCANLINE,
+        TILED
+    };
+
+    Layout         layout    = RETAIN;
+    int            tileXSize = 0;
+    int            tileYSize = 0;
+    Imf::LineOrder lineOrder = Imf::NUM_LINEORDERS; // NUM_LINEORDERS retains input
+};
+
+/// Which API copies the part.
+enum Engine
+{
+    IMF_ENGINE   = 1, // Imf InputPart/OutputPart and friends
+    CORE_ENGINE  = 2, // OpenEXRCore exr_decoding_*/exr_encoding_* directly
+    BOTH_ENGINES = 3  // both, one after the other
+};
+
+/// Encode and decode channels on their own instead of copying the part.
+enum ChannelBreakdown
+{
+    NO_BREAKDOWN,
+    PER_CHANNEL, // every channel in isolation
+    PER_LAYER    // channels grouped by the name before the last '.'
+};
+
+/// Kernel that builds each mip or rip level from the one before.
+enum MipFilter
+{
+    BOX_FILTER, // average of the pixels under the output pixel
+    TENT_FILTER // linear falloff over twice the width, smoother
+};
+
+/// Tiled levels to generate from level 0, instead of copying the part.
+struct MipLevels
+{
+    Imf::LevelMode         mode      = Imf::ONE_LEVEL; // ONE_LEVEL for off
+    Imf::LevelRoundingMode rounding  = Imf::ROUND_DOWN;
+    int                    tileXSize = 64;
+    int                    tileYSize = 64;
+    MipFilter              filter    = BOX_FILTER;
+};
+
+/// How --auto picks a codec from trial encodes of a sample of the part.
+struct AutoCodec
+{
+    enum Objective
+    {
+        OFF,
+        FASTEST_DECODE, // least decode time, predicted size within budget
+        SMALLEST        // least size, encoding at least minEncodeFps
+    };
+
+    Objective objective      = OFF;
+    uint64_t  sizeBudget     = 0;     // bytes; if 0, sizeFraction of raw size
+    double    sizeFraction   = 1;
+    double    minEncodeFps   = 0;
+    double    sampleFraction = 0.1;   // of the 256 line bands of the part
+    bool      lossless       = false; // only try lossless codecs
+};
+
+/// Clients decoding a list of files at the same time, for loadTest ().
+struct LoadTest
+{
+    std::vector<int> clients;      // client counts to run in turn
+    double           rate     = 0; // per client a second; 0 for closed loop
+    double           duration = 5; // seconds for each client count
+};
+
+/// What to measure.
+struct Settings
+{
+    int              part        = 0;
+    Imf::Compression compression = Imf::NUM_COMPRESSION_METHODS; // as input
+    float            level       = INFINITY; // DWA or ZIP level, if finite
+    int              halfMode    = 0; // 0 - leave alone, 1 - just RGBA, 2 - all
+
+    /// If not empty, level 0 of the part is written and read back once for
+    /// each geometry in turn, instead of copying the part.
+    std::vector<OutputGeometry> geometries;
+
+    Engine           engine    = IMF_ENGINE;
+    ChannelBreakdown breakdown = NO_BREAKDOWN;
+
+    /// If not empty, the output is read back once with all channels and
+    /// once with only the channels matching these glob patterns.
+    std::vector<std::string> readChannels;
+
+    /// Convert to the halfMode types in a separate timed stage between
+    /// decode and encode, instead of inside readPixels.
+    bool explicitHalf = false;
+
+    int passes = 1; // repeats of a plain copy
+
+    /// If not empty, each pass of a plain copy with the Imf engine is run
+    /// once for each entry: copying that many chunks, or tile rows of each
+    /// level, at a time through one band sized buffer, or the whole frame
+    /// at once for 0.
+    std::vector<int> bands;
+
+    /// Deep parts: flatten the decoded samples in a timed stage after the
+    /// read, and write the flat image as a scanline part to flattenFile if
+    /// it is not empty.
+    bool        flatten = false;
+    std::string flattenFile;
+
+    AutoCodec autoCodec;
+    MipLevels mipLevels;
+
+    /// If not 0, time reading a preview this many pixels on its longer
+    /// side: of the input on its own, or of every output of a geometry
+    /// sweep or --mip.
+    int preview = 0;
+
+    LoadTest load;
+};
+
+/// One decode, or one copy, of the part with the Imf classes. Times are in
+/// seconds and sizes in bytes; fields a part type has no use for stay 0.
+struct CopyMetrics
+{
+    double   readTime       = 0; // scanline and tiled parts
+    double   countReadTime  = 0; // deep parts: sample counts
+    double   sampleReadTime = 0; // deep parts: samples
+    double   writeTime      = 0;
+    int      tileCount      = 0; // tiled parts, all levels
+    uint64_t pixelCount     = 0;
+    uint64_t sampleCount    = 0; // deep parts
+    uint64_t rawSize        = 0; // decoded pixels, plus deep sample counts
+    double   allocTime      = 0; // getting pixel buffers from the pool
+    double   firstTouchTime = 0; // faulting in newly mapped pool pages
+    int      band           = 0; // chunks or tile rows a band, 0 whole frame
+    uint64_t bufferSize     = 0; // pixel buffers held at once
+    double   flattenTime    = 0; // deep parts with flatten
+    double   flatWriteTime  = 0; // writing the flattened image
+};
+
+/// A small RGBA preview read from a file, timed from opening it.
+struct PreviewMetrics
+{
+    std::string      partType;
+    Imf::Compression compression  = Imf::NUM_COMPRESSION_METHODS;
+    int              xLevel       = 0; // tiled parts: the level read
+    int              yLevel       = 0;
+    int              chunkStep    = 0; // scanline parts: every Nth chunk read
+    int              chunkCount   = 0; // chunks or tiles read
+    int              sourceWidth  = 0; // pixels decoded
+    int              sourceHeight = 0;
+    int              width        = 0; // the preview
+    int              height       = 0;
+    double           openTime     = 0; // header and offset tables
+    double           readTime     = 0;
+    double           scaleTime    = 0;
+    double           totalTime    = 0; // open to preview
+};
+
+/// Level 0 written and read back with one output geometry.
+struct GeometryMetrics
+{
+    std::string    partType;
+    int            tileXSize      = 0; // 0 for scanline output
+    int            tileYSize      = 0;
+    Imf::LineOrder lineOrder      = Imf::INCREASING_Y;
+    int            chunkCount     = 0;
+    double         writeTime      = 0;
+    double         readTime       = 0;
+    uint64_t       outputFileSize = 0;
+    PreviewMetrics preview; // with --preview
+};
+
+/// A channel, or a layer of channels, written and read back on its own.
+struct ChannelGroupMetrics
+{
+    std::string              name;
+    std::vector<std::string> channels;
+    double                   writeTime      = 0;
+    double                   readTime       = 0;
+    uint64_t                 rawSize        = 0;
+    uint64_t                 outputFileSize = 0;
+};
+
+/// The explicit conversion stage, and the library's conversion for
+/// comparison. libraryReadTime and decode.readTime are each the faster of
+/// two runs, taken alternately on a file already read once.
+struct ExplicitHalfMetrics
+{
+    double      convertTime = 0;
+    std::string convertPath; // f16c or scalar
+    int         convertedChannels = 0;
+    double      writeTime         = 0;
+    uint64_t    outputFileSize    = 0;
+    double      libraryReadTime   = 0; // decoding straight to half
+};
+
+/// Reading the output with every channel, then with a subset.
+struct SubsetReadMetrics
+{
+    std::vector<std::string> channels; // the subset
+    double                   fullReadTime   = 0;
+    double                   subsetReadTime = 0;
+    double                   rawFraction    = 0; // subset bytes / all bytes
+};
+
+/// One codec and level, trial encoded on the sample and scaled to the
+/// whole part.
+struct CandidateMetrics
+{
+    Imf::Compression compression         = Imf::NO_COMPRESSION;
+    float            level               = INFINITY; // ZIP and DWA only
+    uint64_t         sampleSize          = 0;
+    double           sampleEncodeTime    = 0;
+    double           sampleDecodeTime    = 0;
+    uint64_t         predictedSize       = 0;
+    double           predictedEncodeTime = 0;
+    double           predictedDecodeTime = 0;
+    bool             feasible            = false; // meets the constraint
+};
+
+/// Codec selection with --auto, and the output written with its choice.
+struct AutoCodecMetrics
+{
+    int                           bandHeight    = 0;
+    int                           bands         = 0;
+    int                           sampleBands   = 0;
+    uint64_t                      sizeBudget    = 0; // resolved to bytes
+    double                        selectionTime = 0; // sampling and trials
+    std::vector<CandidateMetrics> candidates;
+    int                           chosen = -1; // index into candidates
+    double                        writeTime      = 0; // actual, whole part
+    double                        readTime       = 0;
+    uint64_t                      outputFileSize = 0;
+};
+
+/// One generated level, written as tiles.
+struct MipLevelMetrics
+{
+    int    xLevel      = 0;
+    int    yLevel      = 0;
+    int    width       = 0;
+    int    height      = 0;
+    int    tileCount   = 0;
+    double filterTime  = 0; // 0 for level 0, which is the decoded part
+    double convertTime = 0; // float back to half
+    double writeTime   = 0;
+};
+
+/// Level generation with --mip, with level 0 decoded into metrics.decode.
+struct MipMetrics
+{
+    std::string                  filterPath; // avx2 or scalar
+    std::string                  convertPath; // f16c or scalar
+    int                          threads        = 0;
+    double                       toFloatTime    = 0; // half level 0 to float
+    double                       filterTime     = 0; // all levels
+    double                       convertTime    = 0;
+    double                       writeTime      = 0;
+    uint64_t                     outputFileSize = 0;
+    std::vector<MipLevelMetrics> levels; // in the order written
+    PreviewMetrics               preview; // with --preview
+};
+
+/// A copy with the OpenEXRCore engine.
+struct CoreMetrics
+{
+    double   readTime       = 0;
+    double   writeTime      = 0;
+    uint64_t chunkCount     = 0;
+    uint64_t pixelCount     = 0;
+    int      threads        = 0;
+    double   allocTime      = 0; // getting pixel buffers from the pool
+    double   firstTouchTime = 0; // faulting in newly mapped pool pages
+    uint64_t outputFileSize = 0;
+};
+
+/// One client count of a load test. Latencies are in seconds from when a
+/// request was due, so with a fixed rate they include falling behind.
+struct LoadLevelMetrics
+{
+    int      clients       = 0;
+    uint64_t requests      = 0;
+    double   wallTime      = 0;
+    double   throughput    = 0; // requests a second
+    double   rawThroughput = 0; // decoded bytes a second
+    double   meanLatency   = 0;
+    double   p50Latency    = 0;
+    double   p99Latency    = 0;
+    double   p999Latency   = 0;
+    double   maxLatency    = 0;
+
+    /// The global IlmThread pool, shared by every client.
+    int      poolThreads    = 0;
+    uint64_t poolTasks      = 0;
+    double   poolBusy       = 0; // busy time / (wall time * threads)
+    double   meanQueueDepth = 0;
+    int      maxQueueDepth  = 0;
+    double   meanTaskWait   = 0; // queued before a worker picked it up
+};
+
+/// Everything one exrmetrics () call measured.
+struct Metrics
+{
+    Settings         settings; // as passed in
+    Imf::Compression inputCompression    = Imf::NUM_COMPRESSION_METHODS;
+    Imf::Compression outputCompression   = Imf::NUM_COMPRESSION_METHODS;
+    int              zipCompressionLevel = 0;
+    float            dwaCompressionLevel = 0;
+    std::string      partType;
+    int              scanlinesPerChunk = 0; // scanline parts only
+    std::string      bufferPool;           // how the pool hands out buffers
+    uint64_t         inputFileSize  = 0;
+    uint64_t         outputFileSize = 0;   // plain copy, imf's with both
+
+    /// Geometry sweep, channel breakdown, explicit half, auto codec, mip
+    /// levels and preview: decoding the part once, and the pool times of
+    /// the whole run.
+    CopyMetrics                      decode;
+    std::vector<GeometryMetrics>     geometries;
+    std::vector<ChannelGroupMetrics> channelGroups;
+    ExplicitHalfMetrics              explicitHalf;
+    AutoCodecMetrics                 autoCodec;
+    MipMetrics                       mipLevels;
+    PreviewMetrics                   preview; // of the input
+
+    /// Plain copy: one entry per pass with the Imf engine.
+    std::vector<CopyMetrics> passes;
+    uint64_t                 poolSize = 0; // bytes held by a reusing pool
+    CoreMetrics              core;
+    SubsetReadMetrics        subsetRead;
+
+    /// Load test: one entry per client count.
+    std::vector<LoadLevelMetrics> load;
+
+    std::vector<std::string> warnings; // settings that were skipped
+};
+
+/// Settings select between a plain copy and the other modes.
+bool isPlainCopy (const Settings& settings);
+
+/// How pool hands out buffers, as reported.
+const char* poolName (const BufferPool& pool);
+
+/// Open fileName and decode level 0 of a scanline or tiled part into
+/// buffers from pool, as the modes other than a plain copy do.
+CopyMetrics decodeFile (const char fileName[], int part, BufferPool& pool);
+
+/// Copy part settings.part of inFileName to outFileName, or run the mode
+/// the settings select, and return the measurements. Nothing is written to
+/// stdout. All pixel data comes from pool, which is released after each
+/// pass; pass the same pool for every frame to reuse its buffers across
+/// frames. Throws std::exception on errors.
+Metrics exrmetrics (
+    const char      inFileName[],
+    const char      outFileName[],
+    const Settings& settings,
+    BufferPool&     pool);
 #endif
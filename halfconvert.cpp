@@ -0,0 +1,123 @@
+
+//
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) Contributors to the OpenEXR Project.
+//
+
+#include "halfconvert.h"
+
+#include "half.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                             \
+    (defined(__GNUC__) || defined(__clang__))
+#    define HALF_CONVERT_F16C 1
+#    include <immintrin.h>
+#endif
+
+namespace
+{
+
+void
+floatToHalfScalar (const float* in, uint16_t* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        out[i] = half (in[i]).bits ();
+    }
+}
+
+void
+halfToFloatScalar (const uint16_t* in, float* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        half h;
+        h.setBits (in[i]);
+        out[i] = h;
+    }
+}
+
+#ifdef HALF_CONVERT_F16C
+
+//
+// compiled for AVX2+F16C regardless of the global flags, and only called
+// once the CPU has been checked for them
+//
+__attribute__ ((target ("avx2,f16c"))) void
+floatToHalfF16C (const float* in, uint16_t* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256  f = _mm256_loadu_ps (in + i);
+        __m128i h = _mm256_cvtps_ph (f, _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128 (reinterpret_cast<__m128i*> (out + i), h);
+    }
+    floatToHalfScalar (in + i, out + i, n - i);
+}
+
+__attribute__ ((target ("avx2,f16c"))) void
+halfToFloatF16C (const uint16_t* in, float* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i h =
+            _mm_loadu_si128 (reinterpret_cast<const __m128i*> (in + i));
+        _mm256_storeu_ps (out + i, _mm256_cvtph_ps (h));
+    }
+    halfToFloatScalar (in + i, out + i, n - i);
+}
+
+bool
+haveF16C ()
+{
+    static const bool have =
+        __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("f16c");
+    return have;
+}
+
+#endif
+
+} // namespace
+
+void
+floatToHalf (const float* in, uint16_t* out, size_t n)
+{
+#ifdef HALF_CONVERT_F16C
+    if (haveF16C ()) { return floatToHalfF16C (in, out, n); }
+#endif
+    floatToHalfScalar (in, out, n);
+}
+
+void
+halfToFloat (const uint16_t* in, float* out, size_t n)
+{
+#ifdef HALF_CONVERT_F16C
+    if (haveF16C ()) { return halfToFloatF16C (in, out, n); }
+#endif
+    halfToFloatScalar (in, out, n);
+}
+
+void
+uintToHalf (const uint32_t* in, uint16_t* out, size_t n)
+{
+    //
+    // as the library's uintToHalf (): anything above HALF_MAX is infinity,
+    // including the values that would round down to it
+    //
+    for (size_t i = 0; i < n; ++i)
+    {
+        out[i] = in[i] > HALF_MAX ? half::posInf ().bits ()
+                                  : half (static_cast<float> (in[i])).bits ();
+    }
+}
+
+const char*
+halfConvertPath ()
+{
+#ifdef HALF_CONVERT_F16C
+    if (haveF16C ()) { return "f16c"; }
+#endif
+    return "scalar";
+}
@@ -0,0 +1,27 @@
+
+#ifndef INCLUDED_HALF_CONVERT_H
+#define INCLUDED_HALF_CONVERT_H
+
+//----------------------------------------------------------------------------
+//
+//	Bulk float <-> half conversion, with F16C when the CPU has it
+//
+//----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Convert n floats to half, rounding to nearest even.
+void floatToHalf (const float* in, uint16_t* out, size_t n);
+
+/// Convert n halfs to float.
+void halfToFloat (const uint16_t* in, float* out, size_t n);
+
+/// Convert n unsigned ints to half, above HALF_MAX to infinity as the
+/// library does when it reads UINT channels into half.
+void uintToHalf (const uint32_t* in, uint16_t* out, size_t n);
+
+/// Name of the conversion path in use: "f16c" or "scalar".
+const char* halfConvertPath ();
+
+#endif
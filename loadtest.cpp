@@ -0,0 +1,248 @@
+
+//
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) Contributors to the OpenEXR Project.
+//
+
+#include "loadtest.h"
+#include "bufferpool.h"
+#include "threadprovider.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <math.h>
+#include <stdexcept>
+#include <thread>
+
+using namespace std::chrono;
+using std::runtime_error;
+using std::string;
+using std::to_string;
+using std::vector;
+
+namespace
+{
+
+double
+timing (steady_clock::time_point start, steady_clock::time_point end)
+{
+    return std::chrono::duration<double> (end - start).count ();
+}
+
+steady_clock::time_point
+after (steady_clock::time_point start, double seconds)
+{
+    return start + duration_cast<steady_clock::duration> (
+                       duration<double> (seconds));
+}
+
+//
+// what one client thread measured
+//
+struct Client
+{
+    vector<double>     latencies;
+    uint64_t           rawSize = 0;
+    std::exception_ptr error;
+};
+
+//
+// Decode files until the deadline. Clients take files in turn, so that at
+// any moment they are decoding different ones. With a fixed rate, request
+// k of a client is due at (k + client / clients) / rate after start, which
+// spreads the clients' requests evenly.
+//
+void
+runClient (
+    const vector<string>&    files,
+    int                      part,
+    double                   rate,
+    int                      client,
+    int                      clients,
+    const BufferPool&        like,
+    steady_clock::time_point start,
+    steady_clock::time_point deadline,
+    Client&                  result)
+{
+    nameTraceThread (("client " + to_string (client)).c_str ());
+
+    try
+    {
+        BufferPool pool (like.reuse (), like.hugePages ());
+
+        for (uint64_t k = 0;; ++k)
+        {
+            steady_clock::time_point due = steady_clock::now ();
+            if (rate > 0)
+            {
+                due = after (start, (k + double (client) / clients) / rate);
+                if (due >= deadline) { break; }
+                std::this_thread::sleep_until (due);
+            }
+            else if (due >= deadline) { break; }
+
+            const string& file = files[(client + k * clients) % files.size ()];
+            CopyMetrics   decode;
+            {
+                TraceSpan span ("request", "load", "client", client);
+                decode = decodeFile (file.c_str (), part, pool);
+            }
+            pool.release ();
+
+            result.latencies.push_back (timing (due, steady_clock::now ()));
+            result.rawSize += decode.rawSize;
+        }
+    }
+    catch (...)
+    {
+        result.error = std::current_exception ();
+    }
+}
+
+//
+// nearest rank percentile of sorted values
+//
+double
+percentile (const vector<double>& sorted, double p)
+{
+    if (sorted.empty ()) { return NAN; }
+    size_t rank = static_cast<size_t> (ceil (p * sorted.size ()));
+    return sorted[std::min (std::max (rank, size_t (1)), sorted.size ()) - 1];
+}
+
+LoadLevelMetrics
+runLevel (
+    const vector<string>&       files,
+    const Settings&             settings,
+    int                         clients,
+    const BufferPool&           pool,
+    InstrumentedThreadProvider& provider)
+{
+    TraceSpan span ("load level", "mode", "clients", clients);
+
+    vector<Client> results (clients);
+    provider.resetStats ();
+
+    steady_clock::time_point start    = steady_clock::now ();
+    steady_clock::time_point deadline = after (start, settings.load.duration);
+
+    vector<std::thread> threads;
+    for (int c = 0; c < clients; ++c)
+    {
+        threads.emplace_back (
+            runClient,
+            std::cref (files),
+            settings.part,
+            settings.load.rate,
+            c,
+            clients,
+            std::cref (pool),
+            start,
+            deadline,
+            std::ref (results[c]));
+    }
+    for (std::thread& t: threads)
+    {
+        t.join ();
+    }
+    steady_clock::time_point end = steady_clock::now ();
+
+    LoadLevelMetrics m;
+    vector<double>   latencies;
+    uint64_t         rawSize = 0;
+    for (const Client& r: results)
+    {
+        if (r.error) { std::rethrow_exception (r.error); }
+        latencies.insert (
+            latencies.end (), r.latencies.begin (), r.latencies.end ());
+        rawSize += r.rawSize;
+    }
+    std::sort (latencies.begin (), latencies.end ());
+
+    double total = 0;
+    for (double l: latencies)
+    {
+        total += l;
+    }
+
+    m.clients       = clients;
+    m.requests      = latencies.size ();
+    m.wallTime      = timing (start, end);
+    m.throughput    = m.requests / m.wallTime;
+    m.rawThroughput = rawSize / m.wallTime;
+    m.meanLatency   = latencies.empty () ? NAN : total / latencies.size ();
+    m.p50Latency    = percentile (latencies, 0.5);
+    m.p99Latency    = percentile (latencies, 0.99);
+    m.p999Latency   = percentile (latencies, 0.999);
+    m.maxLatency    = latencies.empty () ? NAN : latencies.back ();
+
+    //
+    // without workers, tasks run on the clients and busy is undefined
+    //
+    PoolStats stats  = provider.stats ();
+    m.poolThreads    = provider.numThreads ();
+    m.poolTasks      = stats.tasks;
+    m.poolBusy       = m.poolThreads
+                           ? stats.busyTime / (m.wallTime * m.poolThreads)
+                           : NAN;
+    m.meanQueueDepth = stats.waitTime / m.wallTime;
+    m.maxQueueDepth  = stats.maxQueueDepth;
+    m.meanTaskWait   = stats.tasks ? stats.waitTime / stats.tasks : NAN;
+    return m;
+}
+
+} // namespace
+
+Metrics
+loadTest (
+    const vector<string>&       files,
+    const Settings&             settings,
+    BufferPool&                 pool,
+    InstrumentedThreadProvider& provider)
+{
+    if (files.empty ())
+    {
+        throw runtime_error ("--load needs at least one input file");
+    }
+    for (int clients: settings.load.clients)
+    {
+        if (clients < 1)
+        {
+            throw runtime_error ("--load needs at least one client");
+        }
+    }
+
+    Metrics metrics;
+    metrics.settings   = settings;
+    metrics.bufferPool = poolName (pool);
+    if (!isPlainCopy (settings) || settings.passes > 1 ||
+        !settings.readChannels.empty () || !settings.bands.empty () ||
+        settings.flatten || settings.engine != IMF_ENGINE)
+    {
+        metrics.warnings.push_back (
+            "ignoring copy and mode options: --load only decodes");
+    }
+
+    //
+    // fail before timing anything, and leave the files in the page cache
+    // so every client count starts alike
+    //
+    {
+        TraceSpan span ("warm up", "mode");
+        for (const string& file: files)
+        {
+            decodeFile (file.c_str (), settings.part, pool);
+            pool.release ();
+        }
+    }
+
+    for (int clients: settings.load.clients)
+    {
+        metrics.load.push_back (
+            runLevel (files, settings, clients, pool, provider));
+    }
+    return metrics;
+}
@@ -0,0 +1,36 @@
+
+#ifndef INCLUDED_LOAD_TEST_H
+#define INCLUDED_LOAD_TEST_H
+
+//----------------------------------------------------------------------------
+//
+//	Many clients decoding different files at once through one shared
+//	IlmThread pool, as a review server does
+//
+//----------------------------------------------------------------------------
+
+#include "exrmetrics.h"
+
+#include <string>
+#include <vector>
+
+class InstrumentedThreadProvider;
+
+///
+/// For each count in settings.load.clients, run that many client threads
+/// for settings.load.duration seconds. Each client has its own buffer pool,
+/// set up like pool, and repeatedly decodes level 0 of part settings.part
+/// of the next file in files, either back to back or at settings.load.rate
+/// requests a second. provider must be the global pool's thread provider;
+/// its counters measure how saturated the pool gets.
+///
+/// Every file is decoded once with pool before timing starts. Throws
+/// std::exception on errors.
+///
+Metrics loadTest (
+    const std::vector<std::string>& files,
+    const Settings&                 settings,
+    BufferPool&                     pool,
+    InstrumentedThreadProvider&     provider);
+
+#endif
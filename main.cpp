@@ -4,14 +4,22 @@
 // Copyright (c) Contributors to the OpenEXR Project.
 //
 
+#include "bufferpool.h"
 #include "exrmetrics.h"
+#include "loadtest.h"
+#include "report.h"
+#include "threadprovider.h"
+#include "topology.h"
+#include "trace.h"
 
 #include "ImfMisc.h"
+#include "ImfThreading.h"
 
 #include <iostream>
 #include <vector>
 
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -19,13 +27,107 @@ using std::cerr;
 using std::cout;
 using std::endl;
 using std::ostream;
+using std::string;
 using std::vector;
 using namespace Imf;
 
+vector<string>
+splitList (const char* list)
+{
+    vector<string> items;
+    string         item;
+    for (const char* c = list; *c; ++c)
+    {
+        if (*c == ',')
+        {
+            items.push_back (item);
+            item.clear ();
+        }
+        else { item += *c; }
+    }
+    items.push_back (item);
+    return items;
+}
+
+bool
+parseGeometry (const string& name, OutputGeometry& geometry)
+{
+    if (name == "scanline")
+    {
+        geometry.layout = OutputGeometry::SCANLINE;
+        return true;
+    }
+
+    int  x, y;
+    char extra;
+    if (sscanf (name.c_str (), "%dx%d%c", &x, &y, &extra) == 2) {}
+    else if (sscanf (name.c_str (), "%d%c", &x, &extra) == 1) { y = x; }
+    else { return false; }
+
+    if (x < 1 || y < 1) { return false; }
+
+    geometry.layout    = OutputGeometry::TILED;
+    geometry.tileXSize = x;
+    geometry.tileYSize = y;
+    return true;
+}
+
+//
+// decode:SIZE or size:FPS, where SIZE is bytes with an optional K, M or G
+// suffix, or a percentage of the raw size
+//
+bool
+parseAutoObjective (const string& spec, AutoCodec& autoCodec)
+{
+    size_t colon = spec.find (':');
+    if (colon == string::npos) { return false; }
+    string      objective = spec.substr (0, colon);
+    const char* value     = spec.c_str () + colon + 1;
+    char*       end;
+    double      number = strtod (value, &end);
+    if (end == value || number <= 0) { return false; }
+
+    if (objective == "decode")
+    {
+        autoCodec.objective = AutoCodec::FASTEST_DECODE;
+        switch (*end)
+        {
+            case '%':
+                autoCodec.sizeFraction = number / 100;
+                return end[1] == '\0';
+            case 'K': number *= 1 << 10; ++end; break;
+            case 'M': number *= 1 << 20; ++end; break;
+            case 'G': number *= 1 << 30; ++end; break;
+            default: break;
+        }
+        autoCodec.sizeBudget = static_cast<uint64_t> (number);
+        return *end == '\0';
+    }
+    if (objective == "size")
+    {
+        autoCodec.objective    = AutoCodec::SMALLEST;
+        autoCodec.minEncodeFps = number;
+        return *end == '\0';
+    }
+    return false;
+}
+
+bool
+parseLineOrder (const string& name, LineOrder& lineOrder)
+{
+    if (name == "increasing") { lineOrder = INCREASING_Y; }
+    else if (name == "decreasing") { lineOrder = DECREASING_Y; }
+    else if (name == "random") { lineOrder = RANDOM_Y; }
+    else { return false; }
+    return true;
+}
+
 void
 usageMessage (ostream& stream, const char* program_name, bool verbose = false)
 {
     stream << "Usage: " << program_name << " [options] infile outfile" << endl;
+    stream << "       " << program_name << " --load list [options] infile..."
+           << endl;
 
     if (verbose)
     {
@@ -51,6 +153,136 @@ usageMessage (ostream& stream, const char* program_name, bool verbose = false)
                "  -16 rgba|all  force 16 bit half float: either just RGBA, or all channels\n"
                "                default retains original type for all channels\n"
                "\n"
+               "  --explicit-half\n"
+               "                with -16, decode in the input's channel types and\n"
+               "                convert to half in a separate timed stage (F16C when\n"
+               "                available), then compare with the library converting\n"
+               "                inside readPixels, as a fraction of the read. Only\n"
+               "                level 0 is written\n"
+               "\n"
+               "  --tile list   comma separated output layouts to write and read back:\n"
+               "                'scanline', N for NxN tiles or WxH for WxH tiles.\n"
+               "                Only level 0 of the part is written\n"
+               "\n"
+               "  --lineorder list\n"
+               "                comma separated line orders to write and read back:\n"
+               "                increasing, decreasing or random (tiled only).\n"
+               "                Every line order is tried with every --tile layout\n"
+               "\n"
+               "  --per-channel channel|layer\n"
+               "                instead of copying the part, write and read back each\n"
+               "                channel, or each layer (channels sharing a name up to\n"
+               "                the last '.'), on its own, reporting the time, size and\n"
+               "                compression ratio for each\n"
+               "\n"
+               "  --read-channels list\n"
+               "                after the copy, read the output back once with every\n"
+               "                channel and once with only the channels matching the\n"
+               "                comma separated glob patterns (e.g. R,G,B,A or N.*).\n"
+               "                The output must be a file, not /dev/null\n"
+               "\n"
+               "  --auto decode:size|size:fps\n"
+               "                trial encode a sample of 256 line bands with every\n"
+               "                codec, and ZIP and DWA levels, then write level 0 with\n"
+               "                the codec that decodes fastest within a size budget\n"
+               "                (bytes with K, M or G, or a % of the raw size), or is\n"
+               "                smallest while encoding at least fps frames a second.\n"
+               "                Reports predicted and actual size and times\n"
+               "\n"
+               "  --auto-sample fraction\n"
+               "                fraction of bands to trial encode, default 0.1\n"
+               "\n"
+               "  --auto-lossless\n"
+               "                only consider lossless codecs with --auto\n"
+               "\n"
+               "  --load list   instead of copying, run each comma separated number\n"
+               "                of client threads in turn, every client decoding\n"
+               "                level 0 of the infiles one after another with its\n"
+               "                own buffer pool, all sharing the IlmThread pool.\n"
+               "                Reports throughput, p50/p99/p999 latency and how\n"
+               "                busy and queued the thread pool was\n"
+               "\n"
+               "  --load-rate r each client requests r decodes a second, with latency\n"
+               "                counted from when a request was due. Default is\n"
+               "                closed loop, each request following the last\n"
+               "\n"
+               "  --load-time s seconds to run each client count, default 5\n"
+               "\n"
+               "  --band list   copy each pass once for each comma separated band\n"
+               "                size: n chunks, or n tile rows of each level, at a\n"
+               "                time through one band sized buffer, or 0 for the\n"
+               "                whole frame. Reports buffer size and throughput\n"
+               "                against the whole frame pass\n"
+               "\n"
+               "  --mip mipmap|ripmap\n"
+               "                write a mipmapped or ripmapped tiled part, building\n"
+               "                every level from level 0 of the part with a\n"
+               "                multithreaded separable filter. Reports the filter\n"
+               "                time and the write time of each level\n"
+               "\n"
+               "  --mip-filter box|tent\n"
+               "                level filter, default box\n"
+               "\n"
+               "  --mip-round down|up\n"
+               "                level rounding mode, default down\n"
+               "\n"
+               "  --mip-tile N|WxH\n"
+               "                tile size of the levels, default 64x64\n"
+               "\n"
+               "  --preview n   read an RGBA preview n pixels on its longer side:\n"
+               "                the smallest tiled level at least that large, or\n"
+               "                every Nth scanline chunk, box filtered down to\n"
+               "                size. Reports time to preview from opening the\n"
+               "                file, against decoding the whole part, and writes\n"
+               "                the preview to the output. With --tile, --lineorder\n"
+               "                or --mip, previews each output instead\n"
+               "\n"
+               "  --flatten     for deep parts, composite each pixel's samples front\n"
+               "                to back by Z into a flat image after the read,\n"
+               "                reporting samples a second and the time against\n"
+               "                the deep decode\n"
+               "\n"
+               "  --flatten-out file\n"
+               "                also write the flattened image to file as a\n"
+               "                scanline part. Implies --flatten\n"
+               "\n"
+               "  --passes n    repeat the copy n times, reporting each pass\n"
+               "\n"
+               "  --pool        take pixel buffers from a pool that keeps them across\n"
+               "                passes: uninitialized, 64 byte aligned and faulted in\n"
+               "                once, rather than zero filled vectors every pass\n"
+               "\n"
+               "  --hugepages thp|explicit\n"
+               "                back pooled buffers with transparent huge pages, or\n"
+               "                explicit MAP_HUGETLB pages. Implies --pool\n"
+               "\n"
+               "  -t n          use n threads: sets the global IlmThread pool size for\n"
+               "                the Imf engine and the worker count of the core engine\n"
+               "                default leaves the library default\n"
+               "\n"
+               "  --cpus list   pin the run to a cpulist such as 0-7,16-23: the main\n"
+               "                thread to all of them, IlmThread workers one each in\n"
+               "                turn, and prefer memory on the first CPU's NUMA node\n"
+               "                so buffers are first touched there. Implies --topology\n"
+               "\n"
+               "  --topology    report cores, SMT, caches and NUMA nodes\n"
+               "\n"
+               "  --trace file  write a Chrome trace-event timeline to file, for\n"
+               "                Perfetto: phases on the main thread, every IlmThread\n"
+               "                task on its worker, and every core engine chunk.\n"
+               "                Tasks are wrapped on their way to the library's\n"
+               "                default thread provider, which still schedules them\n"
+               "\n"
+               "  --engine imf|core|both\n"
+               "                copy through the C++ Imf classes, through the\n"
+               "                OpenEXRCore C API directly, or both, reported side by\n"
+               "                side; the core copy then replaces the imf one in the\n"
+               "                output file, each size reported. Default is imf\n"
+               "\n"
+               "  --format json|csv\n"
+               "                report as a JSON object, or as metric,value CSV\n"
+               "                rows. Default is json\n"
+               "\n"
                "  -h, --help    print this message\n"
                "\n"
                "      --version print version information\n"
@@ -62,13 +294,34 @@ int
 main (int argc, char** argv)
 {
 
-    const char* outFile  = nullptr;
-    const char* inFile   = nullptr;
+    vector<string> files;
     int         part     = 0;
     float       level    = INFINITY;
     int         halfMode = 0; // 0 - leave alone, 1 - just RGBA, 2 - everything
+    bool        explicitHalf = false;
+    int         passes   = 1;
+    bool        reuseBuffers = false;
+    HugePages   hugePages    = NO_HUGE_PAGES;
+    int         threads  = -1;
+    bool        reportTopology = false;
+    Placement   placement;
+    const char* traceFile = nullptr;
+    bool        csv       = false;
+    AutoCodec   autoCodec;
+    MipLevels   mipLevels;
+    int         preview = 0;
+    bool        flatten = false;
+    const char* flattenFile = nullptr;
+    LoadTest    load;
+    Engine      engine   = IMF_ENGINE;
+    ChannelBreakdown breakdown = NO_BREAKDOWN;
     Compression compression = Compression::NUM_COMPRESSION_METHODS;
 
+    vector<string>         readChannels;
+    vector<int>            bands;
+    vector<OutputGeometry> layouts;
+    vector<LineOrder>      lineOrders;
+
     int i = 1;
 
     if (argc == 1)
@@ -161,33 +414,541 @@ main (int argc, char** argv)
             }
             i += 2;
         }
-        else if (!inFile)
+        else if (!strcmp (argv[i], "-t"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing thread count with -t option\n";
+                return 1;
+            }
+            threads = atoi (argv[i + 1]);
+            if (threads < 0)
+            {
+                cerr << "bad thread count " << threads
+                     << " specified to -t option\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--engine"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing engine with --engine option\n";
+                return 1;
+            }
+            if (!strcmp (argv[i + 1], "imf")) { engine = IMF_ENGINE; }
+            else if (!strcmp (argv[i + 1], "core")) { engine = CORE_ENGINE; }
+            else if (!strcmp (argv[i + 1], "both")) { engine = BOTH_ENGINES; }
+            else
+            {
+                cerr << " bad engine for --engine option: must be 'imf', "
+                        "'core' or 'both'\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--per-channel"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing grouping with --per-channel option\n";
+                return 1;
+            }
+            if (!strcmp (argv[i + 1], "channel")) { breakdown = PER_CHANNEL; }
+            else if (!strcmp (argv[i + 1], "layer")) { breakdown = PER_LAYER; }
+            else
+            {
+                cerr << " bad grouping for --per-channel option: must be "
+                        "'channel' or 'layer'\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--load"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing client counts with --load option\n";
+                return 1;
+            }
+            for (const string& count: splitList (argv[i + 1]))
+            {
+                int clients = atoi (count.c_str ());
+                if (clients < 1)
+                {
+                    cerr << "bad client count " << count
+                         << " specified to --load option\n";
+                    return 1;
+                }
+                load.clients.push_back (clients);
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--load-rate"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing rate with --load-rate option\n";
+                return 1;
+            }
+            load.rate = atof (argv[i + 1]);
+            if (load.rate <= 0)
+            {
+                cerr << "bad rate " << argv[i + 1]
+                     << " specified to --load-rate option\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--load-time"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing duration with --load-time option\n";
+                return 1;
+            }
+            load.duration = atof (argv[i + 1]);
+            if (load.duration <= 0)
+            {
+                cerr << "bad duration " << argv[i + 1]
+                     << " specified to --load-time option\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--band"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing band sizes with --band option\n";
+                return 1;
+            }
+            for (const string& size: splitList (argv[i + 1]))
+            {
+                char* end;
+                long  band = strtol (size.c_str (), &end, 10);
+                if (size.empty () || *end || band < 0)
+                {
+                    cerr << "bad band size " << size
+                         << " specified to --band option\n";
+                    return 1;
+                }
+                bands.push_back (static_cast<int> (band));
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--mip"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing level mode with --mip option\n";
+                return 1;
+            }
+            if (!strcmp (argv[i + 1], "mipmap"))
+            {
+                mipLevels.mode = MIPMAP_LEVELS;
+            }
+            else if (!strcmp (argv[i + 1], "ripmap"))
+            {
+                mipLevels.mode = RIPMAP_LEVELS;
+            }
+            else
+            {
+                cerr << "bad level mode " << argv[i + 1]
+                     << " for --mip option: must be 'mipmap' or 'ripmap'\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--mip-filter"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing filter with --mip-filter option\n";
+                return 1;
+            }
+            if (!strcmp (argv[i + 1], "box")) { mipLevels.filter = BOX_FILTER; }
+            else if (!strcmp (argv[i + 1], "tent"))
+            {
+                mipLevels.filter = TENT_FILTER;
+            }
+            else
+            {
+                cerr << "bad filter " << argv[i + 1]
+                     << " for --mip-filter option: must be 'box' or 'tent'\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--mip-round"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing rounding mode with --mip-round option\n";
+                return 1;
+            }
+            if (!strcmp (argv[i + 1], "down"))
+            {
+                mipLevels.rounding = ROUND_DOWN;
+            }
+            else if (!strcmp (argv[i + 1], "up"))
+            {
+                mipLevels.rounding = ROUND_UP;
+            }
+            else
+            {
+                cerr << "bad rounding mode " << argv[i + 1]
+                     << " for --mip-round option: must be 'down' or 'up'\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--mip-tile"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing tile size with --mip-tile option\n";
+                return 1;
+            }
+            OutputGeometry geometry;
+            if (!parseGeometry (argv[i + 1], geometry) ||
+                geometry.layout != OutputGeometry::TILED)
+            {
+                cerr << "bad tile size " << argv[i + 1]
+                     << " for --mip-tile option: must be N or WxH\n";
+                return 1;
+            }
+            mipLevels.tileXSize = geometry.tileXSize;
+            mipLevels.tileYSize = geometry.tileYSize;
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--preview"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing size with --preview option\n";
+                return 1;
+            }
+            preview = atoi (argv[i + 1]);
+            if (preview < 1)
+            {
+                cerr << "bad size " << preview
+                     << " specified to --preview option\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--flatten"))
+        {
+            flatten = true;
+            i += 1;
+        }
+        else if (!strcmp (argv[i], "--flatten-out"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing filename with --flatten-out option\n";
+                return 1;
+            }
+            flatten     = true;
+            flattenFile = argv[i + 1];
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--passes"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing pass count with --passes option\n";
+                return 1;
+            }
+            passes = atoi (argv[i + 1]);
+            if (passes < 1)
+            {
+                cerr << "bad pass count " << passes
+                     << " specified to --passes option\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--cpus"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing cpu list with --cpus option\n";
+                return 1;
+            }
+            try
+            {
+                placement.cpus = parseCpuList (argv[i + 1]);
+            }
+            catch (std::exception& what)
+            {
+                cerr << what.what () << " specified to --cpus option\n";
+                return 1;
+            }
+            if (placement.cpus.empty ())
+            {
+                cerr << "empty cpu list specified to --cpus option\n";
+                return 1;
+            }
+            reportTopology = true;
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--trace"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing file name with --trace option\n";
+                return 1;
+            }
+            traceFile = argv[i + 1];
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--auto"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing objective with --auto option\n";
+                return 1;
+            }
+            if (!parseAutoObjective (argv[i + 1], autoCodec))
+            {
+                cerr << "bad objective " << argv[i + 1]
+                     << " for --auto option: must be decode:size or "
+                        "size:fps\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--auto-sample"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing fraction with --auto-sample option\n";
+                return 1;
+            }
+            autoCodec.sampleFraction = atof (argv[i + 1]);
+            if (autoCodec.sampleFraction <= 0 || autoCodec.sampleFraction > 1)
+            {
+                cerr << "bad fraction " << argv[i + 1]
+                     << " specified to --auto-sample option\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--auto-lossless"))
         {
-            inFile = argv[i];
+            autoCodec.lossless = true;
             i += 1;
         }
-        else if (!outFile)
+        else if (!strcmp (argv[i], "--format"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing format with --format option\n";
+                return 1;
+            }
+            if (!strcmp (argv[i + 1], "json")) { csv = false; }
+            else if (!strcmp (argv[i + 1], "csv")) { csv = true; }
+            else
+            {
+                cerr << " bad format for --format option: must be 'json' or "
+                        "'csv'\n";
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--topology"))
+        {
+            reportTopology = true;
+            i += 1;
+        }
+        else if (!strcmp (argv[i], "--pool"))
+        {
+            reuseBuffers = true;
+            i += 1;
+        }
+        else if (!strcmp (argv[i], "--hugepages"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing page type with --hugepages option\n";
+                return 1;
+            }
+            if (!strcmp (argv[i + 1], "thp"))
+            {
+                hugePages = TRANSPARENT_HUGE_PAGES;
+            }
+            else if (!strcmp (argv[i + 1], "explicit"))
+            {
+                hugePages = EXPLICIT_HUGE_PAGES;
+            }
+            else
+            {
+                cerr << " bad page type for --hugepages option: must be 'thp' "
+                        "or 'explicit'\n";
+                return 1;
+            }
+            reuseBuffers = true;
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--explicit-half"))
         {
-            outFile = argv[i];
+            explicitHalf = true;
             i += 1;
         }
+        else if (!strcmp (argv[i], "--read-channels"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing channel list with --read-channels option\n";
+                return 1;
+            }
+            readChannels = splitList (argv[i + 1]);
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--tile"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing layout list with --tile option\n";
+                return 1;
+            }
+            for (const string& name: splitList (argv[i + 1]))
+            {
+                OutputGeometry geometry;
+                if (!parseGeometry (name, geometry))
+                {
+                    cerr << "bad layout " << name
+                         << " for --tile option: must be 'scanline', N or WxH\n";
+                    return 1;
+                }
+                layouts.push_back (geometry);
+            }
+            i += 2;
+        }
+        else if (!strcmp (argv[i], "--lineorder"))
+        {
+            if (i > argc - 2)
+            {
+                cerr << "Missing line order list with --lineorder option\n";
+                return 1;
+            }
+            for (const string& name: splitList (argv[i + 1]))
+            {
+                LineOrder lineOrder;
+                if (!parseLineOrder (name, lineOrder))
+                {
+                    cerr << "bad line order " << name
+                         << " for --lineorder option: must be 'increasing', "
+                            "'decreasing' or 'random'\n";
+                    return 1;
+                }
+                lineOrders.push_back (lineOrder);
+            }
+            i += 2;
+        }
         else
         {
-            cerr << "unknown argument or extra filename specified\n";
-            usageMessage (cerr, "exrmetrics", false);
-            return 1;
+            files.push_back (argv[i]);
+            i += 1;
         }
     }
-    if (!inFile || !outFile)
+    if (load.clients.empty () && files.size () > 2)
+    {
+        cerr << "unknown argument or extra filename specified\n";
+        usageMessage (cerr, "exrmetrics", false);
+        return 1;
+    }
+    if (files.size () < (load.clients.empty () ? 2 : 1))
     {
         cerr << "Missing input or output file\n";
         usageMessage (cerr, "exrmetrics", false);
         return 1;
     }
 
+    //
+    // every line order is tried with every layout
+    //
+    vector<OutputGeometry> geometries;
+    if (!layouts.empty () || !lineOrders.empty ())
+    {
+        if (layouts.empty ()) { layouts.push_back (OutputGeometry ()); }
+        if (lineOrders.empty ()) { lineOrders.push_back (NUM_LINEORDERS); }
+        for (const OutputGeometry& layout: layouts)
+        {
+            for (LineOrder lineOrder: lineOrders)
+            {
+                geometries.push_back (layout);
+                geometries.back ().lineOrder = lineOrder;
+            }
+        }
+    }
+
+    Settings settings;
+    settings.part         = part;
+    settings.compression  = compression;
+    settings.level        = level;
+    settings.halfMode     = halfMode;
+    settings.geometries   = geometries;
+    settings.engine       = engine;
+    settings.breakdown    = breakdown;
+    settings.readChannels = readChannels;
+    settings.explicitHalf = explicitHalf;
+    settings.passes       = passes;
+    settings.bands        = bands;
+    settings.autoCodec    = autoCodec;
+    settings.mipLevels    = mipLevels;
+    settings.preview      = preview;
+    settings.flatten      = flatten;
+    if (flattenFile) { settings.flattenFile = flattenFile; }
+    settings.load         = load;
+
+    if (threads >= 0) { setGlobalThreadCount (threads); }
+
+    //
+    // the load test reads saturation from the provider's counters; tasks
+    // are only wrapped, and still scheduled by the library's default
+    // provider, so traces show its behaviour
+    //
+    InstrumentedThreadProvider* provider = nullptr;
+    if (traceFile) { enableTrace (); }
+    if (traceFile || !load.clients.empty ())
+    {
+        provider = new InstrumentedThreadProvider (globalThreadCount ());
+        IlmThread::ThreadPool::globalThreadPool ().setThreadProvider (provider);
+    }
+
     try
     {
-        exrmetrics (inFile, outFile, part, compression, level, halfMode);
+        //
+        // after the provider is installed: its workers are the ones that
+        // run the library's tasks, so they are the ones to pin
+        //
+        CpuTopology topology;
+        if (reportTopology) { topology = detectTopology (); }
+        applyPlacement (placement, topology);
+
+        BufferPool pool (reuseBuffers, hugePages);
+        Metrics    metrics;
+        if (load.clients.empty ())
+        {
+            metrics = exrmetrics (
+                files[0].c_str (), files[1].c_str (), settings, pool);
+        }
+        else { metrics = loadTest (files, settings, pool, *provider); }
+
+        for (const string& warning: metrics.warnings)
+        {
+            cerr << warning << "\n";
+        }
+
+        const CpuTopology* reported = reportTopology ? &topology : nullptr;
+        if (csv) { writeCsv (cout, metrics, reported, &placement); }
+        else { writeJson (cout, metrics, reported, &placement); }
+
+        if (traceFile) { writeTrace (traceFile); }
     }
     catch (std::exception& what)
     {
@@ -0,0 +1,62 @@
+
+//
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) Contributors to the OpenEXR Project.
+//
+
+#include "memstream.h"
+
+#include "Iex.h"
+
+#include <string.h>
+
+MemoryOStream::MemoryOStream () : Imf::OStream ("memory")
+{}
+
+void
+MemoryOStream::write (const char c[], int n)
+{
+    if (_pos + n > _data.size ()) { _data.resize (_pos + n); }
+    memcpy (_data.data () + _pos, c, n);
+    _pos += n;
+}
+
+uint64_t
+MemoryOStream::tellp ()
+{
+    return _pos;
+}
+
+void
+MemoryOStream::seekp (uint64_t pos)
+{
+    _pos = pos;
+}
+
+MemoryIStream::MemoryIStream (const std::vector<char>& data)
+    : Imf::IStream ("memory"), _data (data)
+{}
+
+bool
+MemoryIStream::read (char c[], int n)
+{
+    if (_pos + n > _data.size ())
+    {
+        throw IEX_NAMESPACE::InputExc ("Unexpected end of file.");
+    }
+    memcpy (c, _data.data () + _pos, n);
+    _pos += n;
+    return _pos < _data.size ();
+}
+
+uint64_t
+MemoryIStream::tellg ()
+{
+    return _pos;
+}
+
+void
+MemoryIStream::seekg (uint64_t pos)
+{
+    _pos = pos;
+}
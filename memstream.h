@@ -0,0 +1,48 @@
+
+#ifndef INCLUDED_MEM_STREAM_H
+#define INCLUDED_MEM_STREAM_H
+
+//----------------------------------------------------------------------------
+//
+//	Imf streams over a block of memory, for encoding and decoding
+//	without touching the file system
+//
+//----------------------------------------------------------------------------
+
+#include "ImfIO.h"
+
+#include <cstdint>
+#include <vector>
+
+class MemoryOStream : public Imf::OStream
+{
+public:
+    MemoryOStream ();
+
+    void     write (const char c[], int n) override;
+    uint64_t tellp () override;
+    void     seekp (uint64_t pos) override;
+
+    const std::vector<char>& data () const { return _data; }
+
+private:
+    std::vector<char> _data;
+    uint64_t          _pos = 0;
+};
+
+/// Reads data, which must outlive the stream.
+class MemoryIStream : public Imf::IStream
+{
+public:
+    explicit MemoryIStream (const std::vector<char>& data);
+
+    bool     read (char c[], int n) override;
+    uint64_t tellg () override;
+    void     seekg (uint64_t pos) override;
+
+private:
+    const std::vector<char>& _data;
+    uint64_t                 _pos = 0;
+};
+
+#endif
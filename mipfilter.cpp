@@ -0,0 +1,244 @@
+
+//
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) Contributors to the OpenEXR Project.
+//
+
+#include "mipfilter.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                             \
+    (defined(__GNUC__) || defined(__clang__))
+#    define MIP_FILTER_AVX2 1
+#    include <immintrin.h>
+#endif
+
+using std::vector;
+
+namespace
+{
+
+//
+// Weights of the source samples under each output sample along one axis.
+// Output sample o averages count[o] source samples from first[o] on.
+//
+struct Taps
+{
+    int           width = 0; // weights stored per output sample
+    vector<int>   first;
+    vector<int>   count;
+    vector<float> weights;
+};
+
+//
+// Output sample o is centred on source coordinate (o + 0.5) * ratio. The
+// box covers the ratio source samples under it, partly covered ones by
+// the fraction covered; the tent falls linearly to 0 at ratio either side,
+// and never narrower than one source sample.
+//
+Taps
+makeTaps (int srcSize, int dstSize, MipFilter filter)
+{
+    double ratio  = double (srcSize) / dstSize;
+    double radius = filter == BOX_FILTER ? ratio / 2 : std::max (ratio, 1.0);
+
+    Taps taps;
+    taps.width = static_cast<int> (ceil (2 * radius)) + 1;
+    taps.first.resize (dstSize);
+    taps.count.resize (dstSize);
+    taps.weights.assign (size_t (dstSize) * taps.width, 0);
+
+    for (int o = 0; o < dstSize; ++o)
+    {
+        double center = (o + 0.5) * ratio;
+        int    lo     = std::max (0, int (floor (center - radius)));
+        int    hi     = std::min (
+            {srcSize,
+             static_cast<int> (ceil (center + radius)),
+             lo + taps.width});
+
+        float* w     = &taps.weights[size_t (o) * taps.width];
+        double total = 0;
+        for (int i = lo; i < hi; ++i)
+        {
+            double weight;
+            if (filter == BOX_FILTER)
+            {
+                weight = std::min (i + 1.0, center + radius) -
+                         std::max (double (i), center - radius);
+            }
+            else { weight = 1 - fabs (i + 0.5 - center) / radius; }
+            weight    = std::max (weight, 0.0);
+            w[i - lo] = static_cast<float> (weight);
+            total += weight;
+        }
+        for (int i = lo; i < hi && total > 0; ++i)
+        {
+            w[i - lo] = static_cast<float> (w[i - lo] / total);
+        }
+        taps.first[o] = lo;
+        taps.count[o] = hi - lo;
+    }
+    return taps;
+}
+
+void
+filterRow (const float* in, float* out, int dstWidth, const Taps& taps)
+{
+    for (int o = 0; o < dstWidth; ++o)
+    {
+        const float* w   = &taps.weights[size_t (o) * taps.width];
+        const float* s   = in + taps.first[o];
+        float        sum = 0;
+        for (int k = 0; k < taps.count[o]; ++k)
+        {
+            sum += w[k] * s[k];
+        }
+        out[o] = sum;
+    }
+}
+
+//
+// out += weight * in, the inner loop of the vertical pass
+//
+void
+accumulateRowScalar (float* out, const float* in, float weight, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        out[i] += weight * in[i];
+    }
+}
+
+#ifdef MIP_FILTER_AVX2
+
+//
+// compiled for AVX2+FMA regardless of the global flags, and only called
+// once the CPU has been checked for them
+//
+__attribute__ ((target ("avx2,fma"))) void
+accumulateRowAvx2 (float* out, const float* in, float weight, size_t n)
+{
+    __m256 w = _mm256_set1_ps (weight);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 sum = _mm256_fmadd_ps (
+            w, _mm256_loadu_ps (in + i), _mm256_loadu_ps (out + i));
+        _mm256_storeu_ps (out + i, sum);
+    }
+    accumulateRowScalar (out + i, in + i, weight, n - i);
+}
+
+bool
+haveAvx2 ()
+{
+    static const bool have =
+        __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma");
+    return have;
+}
+
+#endif
+
+void
+accumulateRow (float* out, const float* in, float weight, size_t n)
+{
+#ifdef MIP_FILTER_AVX2
+    if (haveAvx2 ()) { return accumulateRowAvx2 (out, in, weight, n); }
+#endif
+    accumulateRowScalar (out, in, weight, n);
+}
+
+} // namespace
+
+void
+resamplePlane (
+    const float* src,
+    int          srcWidth,
+    int          srcHeight,
+    float*       dst,
+    int          dstWidth,
+    int          dstHeight,
+    float*       scratch,
+    MipFilter    filter,
+    int          numThreads)
+{
+    if (srcWidth == dstWidth && srcHeight == dstHeight)
+    {
+        memcpy (dst, src, sizeof (float) * size_t (srcWidth) * srcHeight);
+        return;
+    }
+
+    //
+    // an axis that keeps its size is passed through rather than filtered,
+    // so rip levels cost one pass
+    //
+    const float* rows = src;
+    if (srcWidth != dstWidth)
+    {
+        float* out  = srcHeight == dstHeight ? dst : scratch;
+        Taps   taps = makeTaps (srcWidth, dstWidth, filter);
+        parallelFor (srcHeight, numThreads, [&] (int, int y) {
+            filterRow (
+                src + size_t (y) * srcWidth,
+                out + size_t (y) * dstWidth,
+                dstWidth,
+                taps);
+        });
+        rows = out;
+    }
+
+    if (srcHeight != dstHeight)
+    {
+        Taps taps = makeTaps (srcHeight, dstHeight, filter);
+        parallelFor (dstHeight, numThreads, [&] (int, int o) {
+            float*       out = dst + size_t (o) * dstWidth;
+            const float* w   = &taps.weights[size_t (o) * taps.width];
+            std::fill (out, out + dstWidth, 0.0f);
+            for (int k = 0; k < taps.count[o]; ++k)
+            {
+                accumulateRow (
+                    out,
+                    rows + size_t (taps.first[o] + k) * dstWidth,
+                    w[k],
+                    dstWidth);
+            }
+        });
+    }
+}
+
+void
+pointSamplePlane (
+    const uint32_t* src,
+    int             srcWidth,
+    int             srcHeight,
+    uint32_t*       dst,
+    int             dstWidth,
+    int             dstHeight)
+{
+    double xRatio = double (srcWidth) / dstWidth;
+    double yRatio = double (srcHeight) / dstHeight;
+    for (int y = 0; y < dstHeight; ++y)
+    {
+        int sy = std::min (srcHeight - 1, int ((y + 0.5) * yRatio));
+        for (int x = 0; x < dstWidth; ++x)
+        {
+            int sx = std::min (srcWidth - 1, int ((x + 0.5) * xRatio));
+            dst[size_t (y) * dstWidth + x] = src[size_t (sy) * srcWidth + sx];
+        }
+    }
+}
+
+const char*
+mipFilterPath ()
+{
+#ifdef MIP_FILTER_AVX2
+    if (haveAvx2 ()) { return "avx2"; }
+#endif
+    return "scalar";
+}
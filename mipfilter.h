@@ -0,0 +1,47 @@
+
+#ifndef INCLUDED_MIP_FILTER_H
+#define INCLUDED_MIP_FILTER_H
+
+//----------------------------------------------------------------------------
+//
+//	Separable downsampling of float planes for building mip and rip
+//	levels, with AVX2 when the CPU has it
+//
+//----------------------------------------------------------------------------
+
+#include "exrmetrics.h"
+
+#include <stdint.h>
+
+///
+/// Resample the srcWidth x srcHeight plane src to dstWidth x dstHeight in
+/// dst, horizontally then vertically. Each output pixel averages the
+/// source pixels under it with filter's weights, so odd sizes from either
+/// LevelRoundingMode are handled. scratch holds dstWidth * srcHeight
+/// floats. Rows are spread over numThreads threads.
+///
+void resamplePlane (
+    const float* src,
+    int          srcWidth,
+    int          srcHeight,
+    float*       dst,
+    int          dstWidth,
+    int          dstHeight,
+    float*       scratch,
+    MipFilter    filter,
+    int          numThreads);
+
+/// Nearest neighbour version for UINT channels such as ids, which must
+/// not be averaged.
+void pointSamplePlane (
+    const uint32_t* src,
+    int             srcWidth,
+    int             srcHeight,
+    uint32_t*       dst,
+    int             dstWidth,
+    int             dstHeight);
+
+/// Name of the vertical filter path in use: "avx2" or "scalar".
+const char* mipFilterPath ();
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef INCLUDED_PARALLEL_H
+#define INCLUDED_PARALLEL_H
+
+//----------------------------------------------------------------------------
+//
+//	Minimal parallel loop over the IlmThread global pool, the workers
+//	the library decodes and encodes with
+//
+//----------------------------------------------------------------------------
+
+#include "IlmThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+
+namespace parallelDetail
+{
+
+//
+// runs one loop worker as a pool task
+//
+template <class Worker>
+class LoopTask : public IlmThread::Task
+{
+public:
+    LoopTask (IlmThread::TaskGroup* group, Worker& worker, int thread)
+        : Task (group), _worker (worker), _thread (thread)
+    {}
+
+    void execute () override { _worker (_thread); }
+
+private:
+    Worker& _worker;
+    int     _thread;
+};
+
+} // namespace parallelDetail
+
+///
+/// Call fn (thread, i) for every i in [0, count), handing indices out in
+/// increasing order to numThreads loop workers. The calling thread is
+/// worker 0; the others run as tasks on the global IlmThread pool, so no
+/// threads are created per call, and the pool's pinning applies. Workers
+/// only take indices, never wait for each other to start, so a loop
+/// finishes even if the pool is busy or has no threads. Not to be called
+/// from a pool task, which would hold a worker while waiting. The first
+/// exception thrown by fn stops the loop and is rethrown.
+///
+template <class Function>
+void
+parallelFor (int count, int numThreads, Function fn)
+{
+    numThreads = std::max (1, std::min (numThreads, count));
+
+    if (numThreads == 1)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            fn (0, i);
+        }
+        return;
+    }
+
+    std::atomic<int>   next (0);
+    std::exception_ptr error;
+    std::mutex         errorMutex;
+
+    auto worker = [&] (int thread) {
+        try
+        {
+            for (int i = next++; i < count; i = next++)
+            {
+                fn (thread, i);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock (errorMutex);
+            if (!error) { error = std::current_exception (); }
+            next = count;
+        }
+    };
+
+    {
+        //
+        // the group's destructor waits for every task to finish
+        //
+        IlmThread::TaskGroup group;
+        for (int t = 1; t < numThreads; ++t)
+        {
+            IlmThread::ThreadPool::addGlobalTask (
+                new parallelDetail::LoopTask<decltype (worker)> (
+                    &group, worker, t));
+        }
+        worker (0);
+    }
+
+    if (error) { std::rethrow_exception (error); }
+}
+
+#endif
@@ -0,0 +1,748 @@
+
+//
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) Contributors to the OpenEXR Project.
+//
+
+#include "report.h"
+#include "exrmetrics.h"
+#include "topology.h"
+
+#include "ImfPartType.h"
+
+#include <sstream>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace Imf;
+using std::ostream;
+using std::string;
+using std::to_string;
+using std::vector;
+
+namespace
+{
+
+//
+// The layout of the report is walked once, by report () below; a Writer
+// turns it into text.
+//
+class Writer
+{
+public:
+    virtual ~Writer () = default;
+
+    /// Open an object or an array. key is null for elements of an array.
+    virtual void begin (const char key[], bool array) = 0;
+    virtual void end ()                               = 0;
+
+    void number (const char key[], double value)
+    {
+        if (!isfinite (value))
+        {
+            scalar (key, "null", false);
+            return;
+        }
+        std::ostringstream s;
+        s << value;
+        scalar (key, s.str (), false);
+    }
+
+    void count (const char key[], int64_t value)
+    {
+        scalar (key, to_string (value), false);
+    }
+
+    void text (const char key[], const string& value)
+    {
+        scalar (key, value, true);
+    }
+
+    void flag (const char key[], bool value)
+    {
+        scalar (key, value ? "true" : "false", false);
+    }
+
+protected:
+    virtual void
+    scalar (const char key[], const string& value, bool quoted) = 0;
+};
+
+class JsonWriter : public Writer
+{
+public:
+    explicit JsonWriter (ostream& out) : _out (out) {}
+
+    void begin (const char key[], bool array) override
+    {
+        next (key);
+        _out << (array ? "[" : "{");
+        _levels.push_back ({array, 0});
+    }
+
+    void end () override
+    {
+        Level level = _levels.back ();
+        _levels.pop_back ();
+        if (level.members) { _out << "\n" << indent (); }
+        _out << (level.array ? "]" : "}");
+        if (_levels.empty ()) { _out << "\n"; }
+    }
+
+protected:
+    void scalar (const char key[], const string& value, bool quoted) override
+    {
+        next (key);
+        _out << (quoted ? quote (value) : value);
+    }
+
+private:
+    struct Level
+    {
+        bool array;
+        int  members;
+    };
+
+    static string quote (const string& s)
+    {
+        string q = "\"";
+        for (char c: s)
+        {
+            if (c == '"' || c == '\\') { q += '\\'; }
+            if (static_cast<unsigned char> (c) < 0x20)
+            {
+                char escape[8];
+                snprintf (escape, sizeof (escape), "\\u%04x", c);
+                q += escape;
+            }
+            else { q += c; }
+        }
+        return q + "\"";
+    }
+
+    string indent () const { return string (3 * _levels.size (), ' '); }
+
+    //
+    // separator, indent and key of the next member
+    //
+    void next (const char key[])
+    {
+        if (!_levels.empty ())
+        {
+            _out << (_levels.back ().members++ ? ",\n" : "\n") << indent ();
+        }
+        if (key) { _out << quote (key) << ": "; }
+    }
+
+    ostream&      _out;
+    vector<Level> _levels;
+};
+
+class CsvWriter : public Writer
+{
+public:
+    explicit CsvWriter (ostream& out) : _out (out)
+    {
+        _out << "metric,value\n";
+    }
+
+    void begin (const char key[], bool array) override
+    {
+        _path.push_back (name (key));
+        _indices.push_back (array ? 0 : -1);
+    }
+
+    void end () override
+    {
+        _path.pop_back ();
+        _indices.pop_back ();
+    }
+
+protected:
+    void scalar (const char key[], const string& value, bool quoted) override
+    {
+        string metric;
+        for (size_t p = 1; p < _path.size (); ++p)
+        {
+            metric += _path[p] + "/";
+        }
+        metric += name (key);
+        _out << field (metric) << ","
+             << (!quoted && value == "null" ? "" : field (value)) << "\n";
+    }
+
+private:
+    //
+    // a member's key, or the index of an array element
+    //
+    string name (const char key[])
+    {
+        if (key) { return key; }
+        if (_indices.empty () || _indices.back () < 0) { return ""; }
+        return to_string (_indices.back ()++);
+    }
+
+    static string field (const string& s)
+    {
+        if (s.find_first_of (",\"\n") == string::npos) { return s; }
+        string q = "\"";
+        for (char c: s)
+        {
+            if (c == '"') { q += '"'; }
+            q += c;
+        }
+        return q + "\"";
+    }
+
+    ostream&       _out;
+    vector<string> _path;
+    vector<int>    _indices;
+};
+
+const char*
+lineOrderName (LineOrder lineOrder)
+{
+    switch (lineOrder)
+    {
+        case INCREASING_Y: return "increasing";
+        case DECREASING_Y: return "decreasing";
+        case RANDOM_Y: return "random";
+        default: return "unknown";
+    }
+}
+
+string
+compressionName (Compression compression)
+{
+    string name;
+    getCompressionNameFromId (compression, name);
+    return name;
+}
+
+void
+poolTimes (Writer& w, const CopyMetrics& m)
+{
+    w.number ("alloc time", m.allocTime);
+    w.number ("first touch time", m.firstTouchTime);
+}
+
+double
+throughput (const CopyMetrics& m)
+{
+    return m.rawSize / (m.readTime + m.countReadTime + m.sampleReadTime +
+                        m.writeTime);
+}
+
+//
+// wholeFrame is a whole frame pass to compare a banded one with, or null
+//
+void
+bandFields (Writer& w, const CopyMetrics& m, const CopyMetrics* wholeFrame)
+{
+    w.count ("band", m.band);
+    w.count ("buffer size", m.bufferSize);
+    w.number ("throughput", throughput (m));
+    if (m.band > 0 && wholeFrame)
+    {
+        w.number (
+            "throughput vs whole frame",
+            throughput (m) / throughput (*wholeFrame));
+        w.number (
+            "buffer size vs whole frame",
+            double (m.bufferSize) / wholeFrame->bufferSize);
+    }
+}
+
+void
+flattenFields (Writer& w, const Settings& settings, const CopyMetrics& m)
+{
+    double decodeTime = m.countReadTime + m.sampleReadTime;
+
+    w.begin ("flatten", false);
+    w.number ("flatten time", m.flattenTime);
+    w.number ("samples per second", m.sampleCount / m.flattenTime);
+    w.number ("flatten vs deep decode", m.flattenTime / decodeTime);
+    if (!settings.flattenFile.empty ())
+    {
+        w.text ("flat file", settings.flattenFile);
+        w.number ("flat write time", m.flatWriteTime);
+    }
+    w.end ();
+}
+
+void
+copyFields (
+    Writer&            w,
+    const Settings&    settings,
+    const string&      partType,
+    const CopyMetrics& m)
+{
+    bool deep = partType == DEEPSCANLINE || partType == DEEPTILE;
+    if (deep)
+    {
+        w.number ("count read time", m.countReadTime);
+        w.number ("sample read time", m.sampleReadTime);
+    }
+    else { w.number ("read time", m.readTime); }
+    w.number ("write time", m.writeTime);
+    if (partType == TILEDIMAGE) { w.count ("total tiles", m.tileCount); }
+    w.count ("pixel count", m.pixelCount);
+    if (deep) { w.count ("sample count", m.sampleCount); }
+    w.count ("raw size", m.rawSize);
+    poolTimes (w, m);
+    if (deep && settings.flatten) { flattenFields (w, settings, m); }
+}
+
+void
+decodeFields (Writer& w, const CopyMetrics& m)
+{
+    w.number ("read time", m.readTime);
+    w.count ("pixel count", m.pixelCount);
+    w.count ("raw size", m.rawSize);
+}
+
+void
+textList (Writer& w, const char key[], const vector<string>& items)
+{
+    w.begin (key, true);
+    for (const string& item: items)
+    {
+        w.text (nullptr, item);
+    }
+    w.end ();
+}
+
+void
+codecFields (Writer& w, const CandidateMetrics& m)
+{
+    w.text ("compression", compressionName (m.compression));
+    if (isfinite (m.level)) { w.number ("level", m.level); }
+}
+
+void
+autoCodecFields (Writer& w, const Metrics& m)
+{
+    const AutoCodec&        objective = m.settings.autoCodec;
+    const AutoCodecMetrics& a         = m.autoCodec;
+
+    w.begin ("auto", false);
+    if (objective.objective == AutoCodec::FASTEST_DECODE)
+    {
+        w.text ("objective", "decode time");
+        w.count ("size budget", a.sizeBudget);
+    }
+    else
+    {
+        w.text ("objective", "size");
+        w.number ("min encode fps", objective.minEncodeFps);
+    }
+    w.count ("band height", a.bandHeight);
+    w.count ("bands", a.bands);
+    w.count ("sample bands", a.sampleBands);
+    w.number ("selection time", a.selectionTime);
+
+    w.begin ("candidates", true);
+    for (const CandidateMetrics& c: a.candidates)
+    {
+        w.begin (nullptr, false);
+        codecFields (w, c);
+        w.count ("sample size", c.sampleSize);
+        w.number ("sample encode time", c.sampleEncodeTime);
+        w.number ("sample decode time", c.sampleDecodeTime);
+        w.count ("predicted size", c.predictedSize);
+        w.number ("predicted encode time", c.predictedEncodeTime);
+        w.number ("predicted decode time", c.predictedDecodeTime);
+        w.flag ("feasible", c.feasible);
+        w.end ();
+    }
+    w.end ();
+
+    if (a.chosen >= 0)
+    {
+        const CandidateMetrics& c = a.candidates[a.chosen];
+        w.begin ("chosen", false);
+        codecFields (w, c);
+        w.count ("predicted size", c.predictedSize);
+        w.count ("actual size", a.outputFileSize);
+        w.number ("predicted encode time", c.predictedEncodeTime);
+        w.number ("actual write time", a.writeTime);
+        w.number ("predicted decode time", c.predictedDecodeTime);
+        w.number ("actual read time", a.readTime);
+        w.end ();
+    }
+    w.end ();
+}
+
+void
+previewFields (Writer& w, const PreviewMetrics& p)
+{
+    w.begin ("preview", false);
+    w.text ("part type", p.partType);
+    w.text ("compression", compressionName (p.compression));
+    if (p.partType == TILEDIMAGE)
+    {
+        w.count ("x level", p.xLevel);
+        w.count ("y level", p.yLevel);
+        w.count ("tiles read", p.chunkCount);
+    }
+    else
+    {
+        w.count ("chunk step", p.chunkStep);
+        w.count ("chunks read", p.chunkCount);
+    }
+    w.text (
+        "source size",
+        to_string (p.sourceWidth) + "x" + to_string (p.sourceHeight));
+    w.text ("size", to_string (p.width) + "x" + to_string (p.height));
+    w.number ("open time", p.openTime);
+    w.number ("read time", p.readTime);
+    w.number ("scale time", p.scaleTime);
+    w.number ("time to preview", p.totalTime);
+    w.end ();
+}
+
+void
+mipLevelsFields (Writer& w, const Metrics& m)
+{
+    const MipLevels&  settings = m.settings.mipLevels;
+    const MipMetrics& mip      = m.mipLevels;
+
+    w.begin ("mip levels", false);
+    w.text ("level mode", settings.mode == RIPMAP_LEVELS ? "ripmap" : "mipmap");
+    w.text ("rounding", settings.rounding == ROUND_UP ? "up" : "down");
+    w.text (
+        "tile size",
+        to_string (settings.tileXSize) + "x" + to_string (settings.tileYSize));
+    w.text ("filter", settings.filter == TENT_FILTER ? "tent" : "box");
+    w.text ("filter path", mip.filterPath);
+    w.text ("convert path", mip.convertPath);
+    w.count ("threads", mip.threads);
+    w.number ("to float time", mip.toFloatTime);
+    w.number ("filter time", mip.filterTime);
+    w.number ("convert time", mip.convertTime);
+    w.number ("write time", mip.writeTime);
+    w.count ("output file size", mip.outputFileSize);
+    if (m.settings.preview) { previewFields (w, mip.preview); }
+
+    w.begin ("levels", true);
+    for (const MipLevelMetrics& l: mip.levels)
+    {
+        w.begin (nullptr, false);
+        w.count ("x level", l.xLevel);
+        w.count ("y level", l.yLevel);
+        w.count ("width", l.width);
+        w.count ("height", l.height);
+        w.count ("tiles", l.tileCount);
+        w.number ("filter time", l.filterTime);
+        w.number ("convert time", l.convertTime);
+        w.number ("write time", l.writeTime);
+        w.end ();
+    }
+    w.end ();
+    w.end ();
+}
+
+void
+topologyFields (
+    Writer& w, const CpuTopology& topology, const Placement* placement)
+{
+    w.begin ("topology", false);
+    w.count ("logical cpus", topology.logicalCpus);
+    w.count ("cores", topology.cores);
+    w.count ("packages", topology.packages);
+    w.count ("threads per core", topology.threadsPerCore);
+    w.begin ("caches", true);
+    for (const CpuTopology::Cache& cache: topology.caches)
+    {
+        w.begin (nullptr, false);
+        w.count ("level", cache.level);
+        w.text ("type", cache.type);
+        w.text ("size", cache.size);
+        w.count ("instances", cache.instances);
+        w.end ();
+    }
+    w.end ();
+    w.begin ("numa nodes", true);
+    for (const CpuTopology::Node& node: topology.nodes)
+    {
+        w.begin (nullptr, false);
+        w.count ("node", node.id);
+        w.text ("cpus", node.cpus);
+        w.end ();
+    }
+    w.end ();
+    w.end ();
+
+    if (placement && !placement->cpus.empty ())
+    {
+        w.text ("cpus", formatCpuList (placement->cpus));
+        w.count ("memory node", placement->memoryNode);
+    }
+}
+
+void
+loadFields (Writer& w, const Metrics& m)
+{
+    const LoadTest& load = m.settings.load;
+
+    w.begin ("load", false);
+    w.text ("arrivals", load.rate > 0 ? "fixed rate" : "closed loop");
+    if (load.rate > 0) { w.number ("rate per client", load.rate); }
+    w.number ("duration", load.duration);
+
+    w.begin ("clients", true);
+    for (const LoadLevelMetrics& l: m.load)
+    {
+        w.begin (nullptr, false);
+        w.count ("clients", l.clients);
+        w.count ("requests", l.requests);
+        w.number ("wall time", l.wallTime);
+        if (load.rate > 0) { w.number ("offered rate", load.rate * l.clients); }
+        w.number ("throughput", l.throughput);
+        w.number ("raw throughput", l.rawThroughput);
+        w.number ("mean latency", l.meanLatency);
+        w.number ("p50 latency", l.p50Latency);
+        w.number ("p99 latency", l.p99Latency);
+        w.number ("p999 latency", l.p999Latency);
+        w.number ("max latency", l.maxLatency);
+
+        w.begin ("thread pool", false);
+        w.count ("threads", l.poolThreads);
+        w.count ("tasks", l.poolTasks);
+        w.number ("busy", l.poolBusy);
+        w.number ("mean queue depth", l.meanQueueDepth);
+        w.count ("max queue depth", l.maxQueueDepth);
+        w.number ("mean task wait", l.meanTaskWait);
+        w.end ();
+        w.end ();
+    }
+    w.end ();
+    w.end ();
+}
+
+void
+report (
+    Writer&            w,
+    const Metrics&     m,
+    const CpuTopology* topology,
+    const Placement*   placement)
+{
+    const Settings& settings = m.settings;
+
+    w.begin (nullptr, false);
+
+    //
+    // a load test decodes many files, so has no single part to describe
+    //
+    if (!settings.load.clients.empty ())
+    {
+        if (topology) { topologyFields (w, *topology, placement); }
+        w.text ("buffer pool", m.bufferPool);
+        loadFields (w, m);
+        if (!m.warnings.empty ()) { textList (w, "warnings", m.warnings); }
+        w.end ();
+        return;
+    }
+
+    w.text ("input compression", compressionName (m.inputCompression));
+    w.text ("output compression", compressionName (m.outputCompression));
+    if (m.outputCompression == ZIP_COMPRESSION ||
+        m.outputCompression == ZIPS_COMPRESSION)
+    {
+        w.count ("zipCompressionLevel", m.zipCompressionLevel);
+    }
+    if (m.outputCompression == DWAA_COMPRESSION ||
+        m.outputCompression == DWAB_COMPRESSION)
+    {
+        w.number ("dwaCompressionLevel", m.dwaCompressionLevel);
+    }
+    w.text ("part type", m.partType);
+    if (m.partType == SCANLINEIMAGE)
+    {
+        w.count ("scanlines per chunk", m.scanlinesPerChunk);
+    }
+    if (topology) { topologyFields (w, *topology, placement); }
+    w.text ("buffer pool", m.bufferPool);
+
+    if (!isPlainCopy (settings))
+    {
+        w.count ("input file size", m.inputFileSize);
+        decodeFields (w, m.decode);
+
+        if (settings.breakdown != NO_BREAKDOWN)
+        {
+            w.begin ("channels", true);
+            for (const ChannelGroupMetrics& g: m.channelGroups)
+            {
+                w.begin (nullptr, false);
+                w.text ("name", g.name);
+                textList (w, "channels", g.channels);
+                w.number ("write time", g.writeTime);
+                w.number ("read time", g.readTime);
+                w.count ("raw size", g.rawSize);
+                w.count ("output file size", g.outputFileSize);
+                w.number (
+                    "compression ratio", double (g.rawSize) / g.outputFileSize);
+                w.end ();
+            }
+            w.end ();
+        }
+        else if (settings.autoCodec.objective != AutoCodec::OFF)
+        {
+            autoCodecFields (w, m);
+        }
+        else if (settings.mipLevels.mode != ONE_LEVEL)
+        {
+            mipLevelsFields (w, m);
+        }
+        else if (settings.explicitHalf)
+        {
+            const ExplicitHalfMetrics& h = m.explicitHalf;
+            w.number ("convert time", h.convertTime);
+            w.text ("convert path", h.convertPath);
+            w.count ("converted channels", h.convertedChannels);
+            w.number ("write time", h.writeTime);
+            w.count ("output file size", h.outputFileSize);
+            w.number ("library read time", h.libraryReadTime);
+
+            //
+            // what converting inside readPixels adds to the read
+            //
+            w.number (
+                "library conversion fraction",
+                h.libraryReadTime / m.decode.readTime - 1);
+        }
+        else if (settings.geometries.empty ())
+        {
+            //
+            // the whole part was decoded first, to compare with
+            //
+            previewFields (w, m.preview);
+            w.number (
+                "preview time fraction",
+                m.preview.totalTime / m.decode.readTime);
+        }
+        else
+        {
+            w.begin ("geometries", true);
+            for (const GeometryMetrics& g: m.geometries)
+            {
+                w.begin (nullptr, false);
+                w.text ("part type", g.partType);
+                if (g.tileXSize)
+                {
+                    string size =
+                        to_string (g.tileXSize) + "x" + to_string (g.tileYSize);
+                    w.text ("tile size", size);
+                }
+                w.text ("line order", lineOrderName (g.lineOrder));
+                w.count ("chunk count", g.chunkCount);
+                w.number ("write time", g.writeTime);
+                w.number ("read time", g.readTime);
+                w.count ("output file size", g.outputFileSize);
+                if (settings.preview) { previewFields (w, g.preview); }
+                w.end ();
+            }
+            w.end ();
+        }
+        poolTimes (w, m.decode);
+    }
+    else
+    {
+        //
+        // a single pass reports its fields at the top level
+        //
+        size_t bands = settings.bands.size ();
+        if (m.passes.size () == 1)
+        {
+            copyFields (w, settings, m.partType, m.passes[0]);
+            if (bands) { bandFields (w, m.passes[0], nullptr); }
+        }
+        else if (!m.passes.empty ())
+        {
+            w.begin ("passes", true);
+            for (size_t p = 0; p < m.passes.size (); ++p)
+            {
+                w.begin (nullptr, false);
+                copyFields (w, settings, m.partType, m.passes[p]);
+                if (bands)
+                {
+                    //
+                    // compare with the whole frame copy of the same pass
+                    //
+                    const CopyMetrics* wholeFrame = nullptr;
+                    size_t             first      = p - p % bands;
+                    for (size_t b = first; b < first + bands; ++b)
+                    {
+                        if (m.passes[b].band == 0)
+                        {
+                            wholeFrame = &m.passes[b];
+                        }
+                    }
+                    bandFields (w, m.passes[p], wholeFrame);
+                }
+                w.end ();
+            }
+            w.end ();
+        }
+        if (m.poolSize) { w.count ("pool size", m.poolSize); }
+
+        if (settings.engine & CORE_ENGINE)
+        {
+            w.begin ("core", false);
+            w.number ("read time", m.core.readTime);
+            w.number ("write time", m.core.writeTime);
+            w.count ("chunk count", m.core.chunkCount);
+            w.count ("pixel count", m.core.pixelCount);
+            w.count ("threads", m.core.threads);
+            w.number ("alloc time", m.core.allocTime);
+            w.number ("first touch time", m.core.firstTouchTime);
+            w.count ("output file size", m.core.outputFileSize);
+            w.end ();
+        }
+
+        if (!settings.readChannels.empty ())
+        {
+            const SubsetReadMetrics& s = m.subsetRead;
+            w.begin ("subset read", false);
+            textList (w, "channels", s.channels);
+            w.number ("full read time", s.fullReadTime);
+            w.number ("subset read time", s.subsetReadTime);
+            w.number ("subset raw fraction", s.rawFraction);
+            w.number (
+                "subset time fraction", s.subsetReadTime / s.fullReadTime);
+            w.end ();
+        }
+
+        w.count ("input file size", m.inputFileSize);
+        w.count ("output file size", m.outputFileSize);
+    }
+
+    if (!m.warnings.empty ()) { textList (w, "warnings", m.warnings); }
+    w.end ();
+}
+
+} // namespace
+
+void
+writeJson (
+    ostream&           out,
+    const Metrics&     metrics,
+    const CpuTopology* topology,
+    const Placement*   placement)
+{
+    JsonWriter w (out);
+    report (w, metrics, topology, placement);
+}
+
+void
+writeCsv (
+    ostream&           out,
+    const Metrics&     metrics,
+    const CpuTopology* topology,
+    const Placement*   placement)
+{
+    CsvWriter w (out);
+    report (w, metrics, topology, placement);
+}
@@ -0,0 +1,34 @@
+
+#ifndef INCLUDED_REPORT_H
+#define INCLUDED_REPORT_H
+
+//----------------------------------------------------------------------------
+//
+//	Format Metrics as JSON or CSV
+//
+//----------------------------------------------------------------------------
+
+#include <ostream>
+
+struct CpuTopology;
+struct Metrics;
+struct Placement;
+
+/// Write metrics as a single JSON object. The topology, and the placement
+/// if it pinned any CPUs, are included when not null.
+void writeJson (
+    std::ostream&      out,
+    const Metrics&     metrics,
+    const CpuTopology* topology  = nullptr,
+    const Placement*   placement = nullptr);
+
+/// Write the same fields as CSV with a "metric,value" header, one row per
+/// value. A metric is named by its path in the JSON object, e.g.
+/// "passes/1/read time".
+void writeCsv (
+    std::ostream&      out,
+    const Metrics&     metrics,
+    const CpuTopology* topology  = nullptr,
+    const Placement*   placement = nullptr);
+
+#endif
@@ -0,0 +1,197 @@
+
+//
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) Contributors to the OpenEXR Project.
+//
+
+#include "threadprovider.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cxxabi.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+
+#include <stdlib.h>
+
+using IlmThread::Task;
+using std::string;
+
+namespace
+{
+
+//
+// Span name for a task: its class name without namespaces, e.g.
+// LineBufferTask. Names are kept for the life of the process, as the
+// trace only holds pointers to them.
+//
+const char*
+taskName (const Task& task)
+{
+    static std::mutex                        mutex;
+    static std::map<std::type_index, string> names;
+
+    std::lock_guard<std::mutex> lock (mutex);
+    std::type_index             type (typeid (task));
+    auto                        found = names.find (type);
+    if (found == names.end ())
+    {
+        int   status;
+        char* demangled =
+            abi::__cxa_demangle (type.name (), nullptr, nullptr, &status);
+        string name = status == 0 ? demangled : type.name ();
+        free (demangled);
+
+        size_t scope = name.rfind ("::");
+        if (scope != string::npos) { name = name.substr (scope + 2); }
+        found = names.emplace (type, name).first;
+    }
+    return found->second.c_str ();
+}
+
+using Clock = std::chrono::steady_clock;
+
+int64_t
+nanoseconds (Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (end - start)
+        .count ();
+}
+
+//
+// Runs and deletes the library's task, as a span named after it when
+// tracing, counting the time it waited and ran. Has no group of its own.
+// As with any provider, the library's Task destructor does nothing for its
+// group: finishing one task of the group after deleting it is up to us, or
+// the group's destructor waits forever.
+//
+class CountedTask : public Task
+{
+public:
+    CountedTask (
+        Task* task, InstrumentedThreadProvider::Counters& counters, bool worker)
+        : Task (nullptr)
+        , _task (task)
+        , _counters (counters)
+        , _worker (worker)
+        , _queued (Clock::now ())
+    {
+        int depth = ++_counters.queueDepth;
+        int max   = _counters.maxQueueDepth;
+        while (depth > max &&
+               !_counters.maxQueueDepth.compare_exchange_weak (max, depth))
+        {}
+    }
+
+    void execute () override
+    {
+        Clock::time_point start = Clock::now ();
+        --_counters.queueDepth;
+
+        //
+        // the library's workers are named the first time they run a task
+        //
+        static std::atomic<int> workers (0);
+        thread_local bool       named = false;
+        if (_worker && !named)
+        {
+            nameTraceThread (
+                ("IlmThread worker " + std::to_string (workers++)).c_str ());
+            named = true;
+        }
+
+        IlmThread::TaskGroup* group = _task->group ();
+        {
+            TraceSpan span (traceEnabled () ? taskName (*_task) : "", "task");
+            _task->execute ();
+        }
+        delete _task;
+
+        Clock::time_point end = Clock::now ();
+        ++_counters.tasks;
+        _counters.waitTime += nanoseconds (_queued, start);
+        _counters.busyTime += nanoseconds (start, end);
+
+        //
+        // counted before the group's waiter can read the stats
+        //
+        if (group) { group->finishOneTask (); }
+    }
+
+private:
+    Task*                                 _task;
+    InstrumentedThreadProvider::Counters& _counters;
+    bool                                  _worker;
+    Clock::time_point                     _queued;
+};
+
+} // namespace
+
+InstrumentedThreadProvider::InstrumentedThreadProvider (int numThreads)
+    : _pool (new IlmThread::ThreadPool (std::max (numThreads, 0)))
+{}
+
+InstrumentedThreadProvider::~InstrumentedThreadProvider ()
+{
+    finish ();
+}
+
+int
+InstrumentedThreadProvider::numThreads () const
+{
+    return _pool ? _pool->numThreads () : 0;
+}
+
+void
+InstrumentedThreadProvider::setNumThreads (int count)
+{
+    if (!_pool) { _pool.reset (new IlmThread::ThreadPool (0)); }
+    _pool->setNumThreads (count);
+}
+
+void
+InstrumentedThreadProvider::addTask (Task* task)
+{
+    //
+    // no workers: run on the caller, as the default provider does
+    //
+    if (numThreads () == 0)
+    {
+        CountedTask (task, _counters, false).execute ();
+        return;
+    }
+    _pool->addTask (new CountedTask (task, _counters, true));
+}
+
+void
+InstrumentedThreadProvider::finish ()
+{
+    //
+    // the pool's destructor waits for its workers to finish their tasks
+    //
+    _pool.reset ();
+}
+
+PoolStats
+InstrumentedThreadProvider::stats () const
+{
+    PoolStats stats;
+    stats.tasks         = _counters.tasks;
+    stats.busyTime      = _counters.busyTime * 1e-9;
+    stats.waitTime      = _counters.waitTime * 1e-9;
+    stats.maxQueueDepth = _counters.maxQueueDepth;
+    return stats;
+}
+
+void
+InstrumentedThreadProvider::resetStats ()
+{
+    _counters.tasks         = 0;
+    _counters.busyTime      = 0;
+    _counters.waitTime      = 0;
+    _counters.maxQueueDepth = _counters.queueDepth.load ();
+}
@@ -0,0 +1,66 @@
+#ifndef INCLUDED_THREAD_PROVIDER_H
+#define INCLUDED_THREAD_PROVIDER_H
+
+//----------------------------------------------------------------------------
+//
+//	IlmThread pool provider that records every task it runs as a trace
+//	span on the worker that ran it, and counts how busy the pool is,
+//	while the library's own provider does the scheduling
+//
+//----------------------------------------------------------------------------
+
+#include "IlmThreadPool.h"
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+/// How saturated the pool was since the last resetStats (). Times are
+/// summed over tasks, in seconds.
+struct PoolStats
+{
+    uint64_t tasks         = 0;
+    double   busyTime      = 0; // executing
+    double   waitTime      = 0; // queued, before a worker picked it up
+    int      maxQueueDepth = 0;
+};
+
+///
+/// Forwards every task, wrapped in one that times it, to a private
+/// IlmThread::ThreadPool with the library's default provider and the same
+/// number of threads. The queueing and worker wake-ups measured are the
+/// library's own; the wrapper adds an allocation, two clock reads and a
+/// few atomic operations a task. Install with
+/// IlmThread::ThreadPool::globalThreadPool ().setThreadProvider (), which
+/// takes ownership.
+///
+class InstrumentedThreadProvider : public IlmThread::ThreadPoolProvider
+{
+public:
+    explicit InstrumentedThreadProvider (int numThreads);
+    ~InstrumentedThreadProvider () override;
+
+    int  numThreads () const override;
+    void setNumThreads (int count) override;
+    void addTask (IlmThread::Task* task) override;
+    void finish () override;
+
+    PoolStats stats () const;
+    void      resetStats ();
+
+    /// What the task wrappers count into. Times are in nanoseconds.
+    struct Counters
+    {
+        std::atomic<uint64_t> tasks{0};
+        std::atomic<int64_t>  busyTime{0};
+        std::atomic<int64_t>  waitTime{0};
+        std::atomic<int>      queueDepth{0}; // added, not yet started
+        std::atomic<int>      maxQueueDepth{0};
+    };
+
+private:
+    std::unique_ptr<IlmThread::ThreadPool> _pool;
+    Counters                               _counters;
+};
+
+#endif
@@ -0,0 +1,297 @@
+
+//
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) Contributors to the OpenEXR Project.
+//
+
+#include "topology.h"
+
+#include "IlmThreadPool.h"
+#include "ImfThreading.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <stdio.h>
+
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using std::map;
+using std::runtime_error;
+using std::set;
+using std::string;
+using std::to_string;
+using std::vector;
+
+#ifndef MPOL_PREFERRED
+#    define MPOL_PREFERRED 1
+#endif
+
+namespace
+{
+
+const string cpuRoot  = "/sys/devices/system/cpu/";
+const string nodeRoot = "/sys/devices/system/node/";
+
+//
+// first line of a sysfs file, empty if it cannot be read
+//
+string
+readLine (const string& path)
+{
+    std::ifstream file (path);
+    string        line;
+    std::getline (file, line);
+    return line;
+}
+
+void
+setAffinity (const vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    for (int cpu: cpus)
+    {
+        CPU_SET (cpu, &set);
+    }
+    if (sched_setaffinity (0, sizeof (set), &set) != 0)
+    {
+        throw runtime_error (
+            "sched_setaffinity failed for cpus " + formatCpuList (cpus));
+    }
+}
+
+//
+// Each task waits until every pool worker holds one, so no worker can pick
+// up two, then pins the worker it runs on.
+//
+class PinTask : public IlmThread::Task
+{
+public:
+    PinTask (
+        IlmThread::TaskGroup*    group,
+        std::mutex&              mutex,
+        std::condition_variable& ready,
+        int&                     waiting,
+        int                      cpu)
+        : Task (group)
+        , _mutex (mutex)
+        , _ready (ready)
+        , _waiting (waiting)
+        , _cpu (cpu)
+    {}
+
+    void execute () override
+    {
+        {
+            std::unique_lock<std::mutex> lock (_mutex);
+            if (--_waiting == 0) { _ready.notify_all (); }
+            else
+            {
+                _ready.wait (lock, [&] { return _waiting == 0; });
+            }
+        }
+        setAffinity ({_cpu});
+    }
+
+private:
+    std::mutex&              _mutex;
+    std::condition_variable& _ready;
+    int&                     _waiting;
+    int                      _cpu;
+};
+
+} // namespace
+
+vector<int>
+parseCpuList (const string& list)
+{
+    vector<int> cpus;
+    size_t      start = 0;
+    while (start < list.size ())
+    {
+        size_t end = list.find (',', start);
+        if (end == string::npos) { end = list.size (); }
+        string range = list.substr (start, end - start);
+
+        int  first, last;
+        char extra;
+        if (sscanf (range.c_str (), "%d-%d%c", &first, &last, &extra) == 2) {}
+        else if (sscanf (range.c_str (), "%d%c", &first, &extra) == 1)
+        {
+            last = first;
+        }
+        else { throw runtime_error ("bad cpu list " + list); }
+
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+        {
+            throw runtime_error ("bad cpu list " + list);
+        }
+        for (int cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back (cpu);
+        }
+        start = end + 1;
+    }
+    return cpus;
+}
+
+string
+formatCpuList (const vector<int>& cpus)
+{
+    string list;
+    for (size_t i = 0; i < cpus.size ();)
+    {
+        size_t j = i;
+        while (j + 1 < cpus.size () && cpus[j + 1] == cpus[j] + 1)
+        {
+            ++j;
+        }
+        if (!list.empty ()) { list += ","; }
+        list += to_string (cpus[i]);
+        if (j > i) { list += "-" + to_string (cpus[j]); }
+        i = j + 1;
+    }
+    return list;
+}
+
+CpuTopology
+detectTopology ()
+{
+    CpuTopology topology;
+
+    string online = readLine (cpuRoot + "online");
+    if (online.empty ()) { return topology; }
+
+    set<std::pair<int, int>>                 cores;
+    set<int>                                 packages;
+    map<std::pair<int, string>, set<string>> cacheGroups;
+    map<std::pair<int, string>, string>      cacheSizes;
+
+    for (int cpu: parseCpuList (online))
+    {
+        string dir = cpuRoot + "cpu" + to_string (cpu) + "/";
+        int    package =
+            atoi (readLine (dir + "topology/physical_package_id").c_str ());
+        int core = atoi (readLine (dir + "topology/core_id").c_str ());
+
+        ++topology.logicalCpus;
+        cores.insert ({package, core});
+        packages.insert (package);
+
+        for (int index = 0;; ++index)
+        {
+            string cache = dir + "cache/index" + to_string (index) + "/";
+            string level = readLine (cache + "level");
+            if (level.empty ()) { break; }
+
+            std::pair<int, string> key (
+                atoi (level.c_str ()), readLine (cache + "type"));
+            cacheGroups[key].insert (readLine (cache + "shared_cpu_list"));
+            cacheSizes[key] = readLine (cache + "size");
+        }
+    }
+
+    topology.cores    = static_cast<int> (cores.size ());
+    topology.packages = static_cast<int> (packages.size ());
+    topology.threadsPerCore =
+        topology.cores ? topology.logicalCpus / topology.cores : 0;
+
+    for (const auto& group: cacheGroups)
+    {
+        topology.caches.push_back (
+            {group.first.first,
+             group.first.second,
+             cacheSizes[group.first],
+             static_cast<int> (group.second.size ())});
+    }
+
+    string nodes = readLine (nodeRoot + "online");
+    if (!nodes.empty ())
+    {
+        for (int node: parseCpuList (nodes))
+        {
+            topology.nodes.push_back (
+                {node,
+                 readLine (nodeRoot + "node" + to_string (node) + "/cpulist")});
+        }
+    }
+
+    return topology;
+}
+
+int
+nodeOfCpu (const CpuTopology& topology, int cpu)
+{
+    for (const CpuTopology::Node& node: topology.nodes)
+    {
+        vector<int> cpus = parseCpuList (node.cpus);
+        if (std::find (cpus.begin (), cpus.end (), cpu) != cpus.end ())
+        {
+            return node.id;
+        }
+    }
+    return -1;
+}
+
+void
+applyPlacement (Placement& placement, const CpuTopology& topology)
+{
+    if (placement.cpus.empty ()) { return; }
+
+    setAffinity (placement.cpus);
+
+    //
+    // memory first touched by this thread goes to the first CPU's node
+    //
+    placement.memoryNode = nodeOfCpu (topology, placement.cpus[0]);
+    if (placement.memoryNode >= 0)
+    {
+        //
+        // a node mask wide enough for the highest node; the kernel reads
+        // one bit fewer than maxnode
+        //
+        const int bits    = sizeof (unsigned long) * 8;
+        int       maxNode = placement.memoryNode;
+        for (const CpuTopology::Node& node: topology.nodes)
+        {
+            maxNode = std::max (maxNode, node.id);
+        }
+        vector<unsigned long> mask (maxNode / bits + 1, 0);
+        mask[placement.memoryNode / bits] |= 1UL
+                                             << (placement.memoryNode % bits);
+
+        unsigned long maxnode = mask.size () * bits + 1;
+        if (syscall (
+                SYS_set_mempolicy, MPOL_PREFERRED, mask.data (), maxnode) != 0)
+        {
+            placement.memoryNode = -1;
+        }
+    }
+
+    int workers = Imf::globalThreadCount ();
+    if (workers < 1) { return; }
+
+    std::mutex              mutex;
+    std::condition_variable ready;
+    int                     waiting = workers;
+    {
+        IlmThread::TaskGroup group;
+        for (int w = 0; w < workers; ++w)
+        {
+            IlmThread::ThreadPool::addGlobalTask (new PinTask (
+                &group,
+                mutex,
+                ready,
+                waiting,
+                placement.cpus[w % placement.cpus.size ()]));
+        }
+    }
+}
@@ -0,0 +1,69 @@
+
+#ifndef INCLUDED_TOPOLOGY_H
+#define INCLUDED_TOPOLOGY_H
+
+//----------------------------------------------------------------------------
+//
+//	CPU topology detection and thread/memory placement (Linux)
+//
+//----------------------------------------------------------------------------
+
+#include <string>
+#include <vector>
+
+/// What the machine looks like, as far as sysfs tells us.
+struct CpuTopology
+{
+    struct Cache
+    {
+        int         level;
+        std::string type;      // Data, Instruction or Unified
+        std::string size;      // as sysfs reports it, e.g. 32K
+        int         instances; // distinct groups of CPUs sharing one
+    };
+
+    struct Node
+    {
+        int         id;
+        std::string cpus; // cpulist format, e.g. 0-15,32-47
+    };
+
+    int                logicalCpus    = 0;
+    int                cores          = 0;
+    int                packages       = 0;
+    int                threadsPerCore = 0;
+    std::vector<Cache> caches;
+    std::vector<Node>  nodes;
+};
+
+/// Where to run and where to put memory.
+struct Placement
+{
+    std::vector<int> cpus;            // empty leaves affinity alone
+    int              memoryNode = -1; // node of cpus[0], once applied
+};
+
+/// Read the topology from /sys/devices/system.
+CpuTopology detectTopology ();
+
+/// Parse a cpulist such as "0-3,8,10-11". Throws on bad input.
+std::vector<int> parseCpuList (const std::string& list);
+
+/// Format cpus as a cpulist.
+std::string formatCpuList (const std::vector<int>& cpus);
+
+/// NUMA node of cpu, -1 if unknown.
+int nodeOfCpu (const CpuTopology& topology, int cpu);
+
+///
+/// Restrict the calling thread to placement.cpus, prefer allocating its
+/// memory on the node of the first of them, and pin each IlmThread global
+/// pool worker to one of them in turn. parallelFor loops run on the calling
+/// thread and those workers, so are pinned too; threads created later by
+/// the calling thread inherit its affinity. Call after
+/// setGlobalThreadCount () and after installing any thread provider, so
+/// that the workers pinned are the ones that will run tasks.
+///
+void applyPlacement (Placement& placement, const CpuTopology& topology);
+
+#endif
@@ -0,0 +1,158 @@
+
+//
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) Contributors to the OpenEXR Project.
+//
+
+#include "trace.h"
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace
+{
+
+struct Event
+{
+    const char*              name;
+    const char*              category;
+    const char*              argName;
+    int64_t                  arg;
+    steady_clock::time_point start;
+    steady_clock::time_point end;
+};
+
+//
+// Each thread appends to its own list, so recording takes no lock. The
+// lists belong to the trace rather than the thread, so spans of threads
+// that have exited are still written.
+//
+struct ThreadTrace
+{
+    int           id;
+    string        name;
+    vector<Event> events;
+};
+
+std::atomic<bool>                    enabled (false);
+steady_clock::time_point             origin;
+std::mutex                           threadsMutex;
+vector<std::unique_ptr<ThreadTrace>> threads;
+
+ThreadTrace&
+threadTrace ()
+{
+    thread_local ThreadTrace* trace = nullptr;
+    if (!trace)
+    {
+        std::lock_guard<std::mutex> lock (threadsMutex);
+        threads.emplace_back (new ThreadTrace);
+        trace     = threads.back ().get ();
+        trace->id = static_cast<int> (threads.size ()) - 1;
+    }
+    return *trace;
+}
+
+string
+quoted (const string& s)
+{
+    string q = "\"";
+    for (char c: s)
+    {
+        if (c == '"' || c == '\\') { q += '\\'; }
+        q += c;
+    }
+    return q + "\"";
+}
+
+int64_t
+micros (steady_clock::time_point t)
+{
+    return duration_cast<microseconds> (t - origin).count ();
+}
+
+} // namespace
+
+void
+enableTrace ()
+{
+    origin = steady_clock::now ();
+    enabled.store (true, std::memory_order_release);
+    nameTraceThread ("main");
+}
+
+bool
+traceEnabled ()
+{
+    return enabled.load (std::memory_order_relaxed);
+}
+
+void
+nameTraceThread (const char name[])
+{
+    if (traceEnabled ()) { threadTrace ().name = name; }
+}
+
+void
+traceSpan (
+    const char               name[],
+    const char               category[],
+    steady_clock::time_point start,
+    steady_clock::time_point end,
+    const char               argName[],
+    int64_t                  arg)
+{
+    if (!traceEnabled ()) { return; }
+    threadTrace ().events.push_back (
+        {name, category, argName, arg, start, end});
+}
+
+void
+writeTrace (const char fileName[])
+{
+    std::ofstream file (fileName);
+    if (!file) { throw runtime_error (string ("cannot write ") + fileName); }
+
+    std::lock_guard<std::mutex> lock (threadsMutex);
+
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    const char* separator = "";
+    for (const std::unique_ptr<ThreadTrace>& thread: threads)
+    {
+        string name = thread->name.empty ()
+                          ? "thread " + std::to_string (thread->id)
+                          : thread->name;
+        file << separator << "{\"ph\": \"M\", \"name\": \"thread_name\", "
+             << "\"pid\": 1, \"tid\": " << thread->id
+             << ", \"args\": {\"name\": " << quoted (name) << "}}";
+        separator = ",\n";
+
+        for (const Event& event: thread->events)
+        {
+            file << separator << "{\"ph\": \"X\", \"name\": "
+                 << quoted (event.name) << ", \"cat\": "
+                 << quoted (event.category) << ", \"pid\": 1, \"tid\": "
+                 << thread->id << ", \"ts\": " << micros (event.start)
+                 << ", \"dur\": " << micros (event.end) - micros (event.start);
+            if (event.argName)
+            {
+                file << ", \"args\": {" << quoted (event.argName) << ": "
+                     << event.arg << "}";
+            }
+            file << "}";
+        }
+    }
+    file << "\n]}\n";
+
+    if (!file) { throw runtime_error (string ("error writing ") + fileName); }
+}
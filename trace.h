@@ -0,0 +1,78 @@
+
+#ifndef INCLUDED_TRACE_H
+#define INCLUDED_TRACE_H
+
+//----------------------------------------------------------------------------
+//
+//	Timeline of timed spans per thread, written in Chrome trace-event
+//	format for viewing in Perfetto or chrome://tracing
+//
+//----------------------------------------------------------------------------
+
+#include <chrono>
+#include <cstdint>
+
+/// Start recording. Until this is called, recording costs one branch.
+void enableTrace ();
+
+bool traceEnabled ();
+
+/// Name the calling thread in the timeline. The name is copied.
+void nameTraceThread (const char name[]);
+
+///
+/// Record a span that ran on the calling thread. name, category and argName
+/// must outlive the trace, e.g. string literals. If argName is not null the
+/// span carries arg as a single integer argument.
+///
+void traceSpan (
+    const char                            name[],
+    const char                            category[],
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end,
+    const char                            argName[] = nullptr,
+    int64_t                               arg       = 0);
+
+/// Write everything recorded so far. Call when no thread is recording.
+void writeTrace (const char fileName[]);
+
+/// Records a span from construction to destruction.
+class TraceSpan
+{
+public:
+    TraceSpan (
+        const char name[],
+        const char category[],
+        const char argName[] = nullptr,
+        int64_t    arg       = 0)
+        : _name (name), _category (category), _argName (argName), _arg (arg)
+    {
+        if (traceEnabled ()) { _start = std::chrono::steady_clock::now (); }
+    }
+
+    ~TraceSpan ()
+    {
+        if (traceEnabled ())
+        {
+            traceSpan (
+                _name,
+                _category,
+                _start,
+                std::chrono::steady_clock::now (),
+                _argName,
+                _arg);
+        }
+    }
+
+    TraceSpan (const TraceSpan&)            = delete;
+    TraceSpan& operator= (const TraceSpan&) = delete;
+
+private:
+    const char*                           _name;
+    const char*                           _category;
+    const char*                           _argName;
+    int64_t                               _arg;
+    std::chrono::steady_clock::time_point _start;
+};
+
+#endif